@@ -0,0 +1,114 @@
+#ifndef AUTOHISTOGRAM_H
+#define AUTOHISTOGRAM_H
+
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+#include "TH1.h"
+#include "TH2.h"
+
+// Histogram that finds its own range while it is filled. The first values are
+// buffered, then fine bins with a power of two width are laid over their range
+// and widened whenever a value falls outside. Bins are aligned to multiples of
+// their width, so histograms filled separately merge without loss. A few
+// values that would make the bins much wider are kept aside exactly instead.
+class AutoHistogram {
+public:
+    // Fine enough to be rebinned to any terminal size
+    constexpr static int default_bins = 8192;
+    constexpr static int default_bins_2d = 512; // Per axis
+    constexpr static std::size_t default_buffer = 10000;
+    // Values that would widen the bins 2^outlier_widening times are kept
+    // aside, up to max_outliers distinct points. Later ones widen the bins
+    // like any other value, so memory stays bounded and quantiles are then
+    // exact to within one of the wider fine bins
+    constexpr static int outlier_widening = 6;
+    constexpr static std::size_t max_outliers = 1000;
+
+    // 1D or 2D, bufferSize is the number of points kept before bins are laid out
+    explicit AutoHistogram(int dims = 1, std::size_t bufferSize = default_buffer);
+
+    // Fixed range, values outside are ignored
+    void setRange(int axis, double min, double max);
+
+    void fill(double x, double w = 1.0);
+    void fill(double x, double y, double w);
+    // Block of n points, y is nullptr in 1D and w is nullptr for unit weights
+    void fill(std::size_t n, const double* x, const double* y, const double* w);
+    void merge(const AutoHistogram& other);
+
+    int dimension() const;
+    Long64_t entries() const;
+    bool empty() const;
+    // Extremes of the filled values
+    double min(int axis = 0) const;
+    double max(int axis = 0) const;
+    // NaN and Inf values are counted but not filled
+    Long64_t nonFinite() const;
+    // Value below which the fraction q of the weight lies, NaN if empty.
+    // Within one fine bin, exact while buffering and for values kept aside
+    double quantile(double q, int axis = 0) const;
+    // Bytes held by this histogram
+    std::size_t memoryUsage() const;
+
+    // Range of nbins display bins covering [min, max], each of them a whole
+    // number of fine bins. Unchanged while buffering
+    std::pair<double, double> alignedRange(int axis, double min, double max, int nbins) const;
+    // Fill display histogram. Each fine bin goes whole into the display bin
+    // of its center, which is exact on an aligned range. Buffered values are
+    // filled exactly
+    void project(TH1D& hist) const;
+    void project(TH2D& hist) const;
+
+private:
+    struct Axis {
+        int nbins = default_bins;
+        bool fixed = false;
+        double lo = 0;
+        double hi = 0;
+        // Automatic range: bin i covers [offset + i, offset + i + 1) * 2^exp
+        int exp = 0;
+        long long offset = 0;
+
+        double min = std::numeric_limits<double>::infinity();
+        double max = -std::numeric_limits<double>::infinity();
+        double sumwx = 0;
+        double sumwx2 = 0;
+        // Extremes of the values in the bins, without the ones kept aside
+        double low = std::numeric_limits<double>::infinity();
+        double high = -std::numeric_limits<double>::infinity();
+
+        long long globalBin(double x, int e) const;
+        int fitExponent(int e, double from, double to) const;
+        int bin(double x) const; // Outside [0, nbins) if the axis has to be widened
+        std::pair<double, double> edges(int i) const;
+    };
+
+    void fillPoint(const double* x, double w);
+    void insert(const double* x, double w);
+    void mergeOutliers(const AutoHistogram& other);
+    void flush();
+    void rebin(int axis, int exp, long long offset);
+    void widen(int axis, int exp, double lo);
+    std::size_t cell(int ix, int iy) const;
+    // Display bin holding fine bin i of axis, including under- and overflow
+    int displayBin(int axis, int i, const TAxis* display) const;
+
+    int m_dims;
+    std::size_t m_bufferSize;
+    std::array<Axis, 2> m_axes;
+    std::vector<double> m_buffer; // Values and weight per point, before the range is known
+    std::vector<double> m_bins; // Empty while buffering
+    std::map<std::pair<double, double>, double> m_outliers; // Point kept aside -> weight
+
+    double m_sumw = 0;
+    double m_sumw2 = 0;
+    double m_sumwxy = 0;
+    Long64_t m_entries = 0;
+    Long64_t m_nonFinite = 0;
+};
+
+#endif // AUTOHISTOGRAM_H
@@ -2,6 +2,12 @@
 #define BROWSER_H
 
 #include <ncurses.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
 
 #include "TTree.h"
 #include "TLeaf.h"
@@ -12,6 +18,8 @@
 #include "Console.h"
 #include "definitions.h"
 #include "RootFile.h"
+#include "DrawEngine.h"
+#include "HistogramCache.h"
 #include "Menu.h"
 #include <nlohmann/json.hpp>
 
@@ -24,6 +32,12 @@ public:
 
     void loadFile(std::string filename);
     void printDirectories();
+    void handleIndexUpdate();
+    // Progress or result of the draw running in the background
+    void handleDrawUpdate();
+    // Background work done between key strokes
+    bool hasIdleWork();
+    void handleIdle();
 
     void handleInputEvent(MEVENT& mouse, int key);
     void handleResize(bool force=false);
@@ -43,19 +57,61 @@ private:
     void handleMenuSelect();
     void handleMouseClick(int y, int x);
     void handleInput(int key);
+    // Restart the prefetch delay when another leaf gets highlighted
+    void followSelection();
     static bool isClickInWindow(WINDOW*&, int y, int x);
 
     // plot option toggles
     void toggleStatsBox();
     void toggleLogy();
+    void toggleSampleOnly();
+    void toggleRobustRange();
+    // Table of leaf statistics, sorted by the next column or reversed
+    void cycleSummaryColumn();
+    void reverseSummaryOrder();
 
     // plot commands
     void plotHistogram(TTree*, TLeaf*);
     void plotHistogram(const Console::DrawArgs&);
     void plot2DHistogram(const Console::DrawArgs&);
+    // "a; b; c" as a grid of small plots
+    void plotHistograms(const Console::DrawArgs&);
+    // Filled histogram from cache or tree, nullptr on error
+    const AutoHistogram* getHistogram(const std::string& title, TTree*, const std::string& varexp,
+                                      const std::string& selection, const std::vector<double>& limits,
+                                      Long64_t nentries, Long64_t firstentry);
+    // One histogram per expression, all read in the same pass. Empty while reading
+    std::vector<const AutoHistogram*> getHistograms(const std::string& title, TTree*,
+                                                    const std::vector<std::string>& varexps,
+                                                    const std::string& selection, const std::vector<double>& limits,
+                                                    Long64_t nentries, Long64_t firstentry);
+    // Cache key of a draw with the current sampling mode
+    HistogramCache::Key drawKey(TTree*, const std::string& varexp, const std::string& selection,
+                                const std::vector<double>& limits, Long64_t nentries, Long64_t firstentry) const;
+    // Fill on a worker thread, a newer draw cancels the running one. A
+    // speculative draw runs on prefetch_threads and is taken over once requested
+    void startDraw(TTree*, const HistogramCache::Key&, bool speculative=false);
+    void cancelDraw();
+    // Statistics of all leaves of the active tree, computed on the draw worker
+    void describeTree();
+    // Partial histogram with progress bar while a draw is reading
+    void plotProgress(const std::vector<AutoHistogram>& partial, Long64_t processed, Long64_t total);
+    void plotProgressBar(Long64_t processed, Long64_t total);
+    void plotFilledHistogram(const AutoHistogram&, const std::string& title, const std::vector<double>& limits);
+    void plotFilledHistogram2D(const AutoHistogram&, const std::string& title, const std::vector<double>& limits);
+    void plotGrid(const std::vector<const AutoHistogram*>&, const std::vector<std::string>& titles, const std::string& title);
+    // One plot of the grid in the given cells of main_window
+    void plotPanel(const AutoHistogram&, const std::string& title, int y, int x, int height, int width);
+    // Statistics of summary_view.tree, scrolled to the highlighted leaf
+    void plotSummary();
+    // Axes of a single plot are drawn outside main_window
+    void clearAxisArea();
+    void replot();
+    // Axis range of a plot without limits, see robust_range
+    std::pair<double, double> plotRange(const AutoHistogram&, int axis) const;
     void plotXAxis(AxisTicks&, bool force_range);
     void plotYAxis(AxisTicks&, bool force_range);
-    void plotCanvasAnnotations(TH1* hist);
+    void plotCanvasAnnotations(TH1* hist, const AutoHistogram& filled);
     void plotCanvasAnnotations(TH2* hist);
     void plotASCIIHistogram(TH1D* hist, int binsy, int binsx, double ymin, double ymax) const;
     void plotASCIIHistogram2D(TH2D* hist, int binsy, int binsx);
@@ -91,11 +147,22 @@ private:
     int yaxis_spacing = 5;
 
     constexpr static float top_hist_clear = 1.1; // Extra space
+    // Trees this large get a preview from a fraction of their clusters first
+    constexpr static Long64_t preview_min_entries = 1000000;
+    double sample_fraction = 0.01;
+    // Highlighted leaf is filled in the background after resting this long
+    constexpr static std::chrono::milliseconds prefetch_delay{300};
+    constexpr static unsigned prefetch_threads = 1; // Fill threads of a prefetch
+    // Weight left outside each side of the axis in robust range mode
+    constexpr static double robust_quantile = 0.001;
 
     // Toggles
     bool showstats = true;
     bool logscale = false;
     bool is_running = true; // false if program should end
+    bool sample_only = false; // Stay with the preview of large trees
+    bool robust_range = false; // Axis from quantiles instead of the extremes
+    bool prefetch = false; // Fill the highlighted leaf before it is selected
     
     int blockmode = 2;
 
@@ -104,6 +171,54 @@ private:
 
     // ROOT
     RootFile root_file;
+    ColumnCache column_cache;
+    SelectionCache selection_cache;
+    KernelCompiler kernel_compiler;
+    DrawEngine draw_engine;
+    HistogramCache histogram_cache;
+    // Last plot, redrawn from the cache when the window size changes
+    struct LastPlot {
+        HistogramCache::Key key;
+        std::string title;
+    } last_plot;
+    bool plotting = false;
+    // Sets plotting for the lifetime of a plot call
+    struct PlottingScope {
+        explicit PlottingScope(bool& flag) : m_flag(flag) { m_flag = true; }
+        ~PlottingScope() { m_flag = false; }
+        PlottingScope(const PlottingScope&) = delete;
+        PlottingScope& operator=(const PlottingScope&) = delete;
+    private:
+        bool& m_flag;
+    };
+    // Draw running on a worker thread, reports to the main loop through the pipe
+    struct DrawJob {
+        HistogramCache::Key key; // Expressions "a;b;c" are filled together
+        bool speculative = false; // Prefetch nobody asked for yet, main thread only
+        bool describe = false; // Leaf statistics instead of histograms
+        std::mutex mutex; // Guards the fields below
+        std::optional<std::vector<AutoHistogram>> partial;
+        Long64_t processed = 0;
+        Long64_t total = 0;
+        std::optional<std::vector<AutoHistogram>> result; // One per expression
+        std::optional<std::vector<DrawEngine::LeafSummary>> summary; // Of key.tree, if describe
+        std::string error;
+        bool finished = false;
+        std::jthread worker; // Joined on destruction, before the fields above
+    };
+    std::unique_ptr<DrawJob> draw_job;
+    // Leaf statistics of described trees, also shown in the status bar
+    std::unordered_map<const TTree*, std::vector<DrawEngine::LeafSummary>> tree_summaries;
+    struct SummaryView {
+        const TTree* tree = nullptr; // Shown instead of the last plot if set
+        int column = 0; // Sort column of the table
+        bool descending = false;
+    } summary_view;
+    struct Prefetch {
+        RootFile::Node leaf; // Highlighted leaf, default if none
+        std::chrono::steady_clock::time_point due;
+        bool pending = false;
+    } prefetch_state;
     
     // skip next directory draw
     bool skipDraw = false;
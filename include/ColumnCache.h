@@ -0,0 +1,19 @@
+#ifndef COLUMNCACHE_H
+#define COLUMNCACHE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "LruCache.h"
+
+// Decompressed values of a drawn leaf, one per entry
+template <>
+struct CacheTraits<std::vector<double>> {
+    constexpr static std::size_t default_budget = std::size_t(512) << 20;
+    static std::size_t bytes(const std::vector<double>& column) { return column.size() * sizeof(double); }
+};
+
+// Recently drawn leaves, keyed by file, tree and leaf
+using ColumnCache = LruCache<std::string, std::vector<double>>;
+
+#endif // COLUMNCACHE_H
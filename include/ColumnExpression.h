@@ -0,0 +1,51 @@
+#ifndef COLUMNEXPRESSION_H
+#define COLUMNEXPRESSION_H
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Arithmetic expression of scalar columns, the subset of TTreeFormula syntax
+// that can be evaluated from cached values: numbers, names, + - * /,
+// comparisons, && || !, parentheses and common math functions. Evaluated a
+// block of entries at a time.
+class ColumnExpression {
+public:
+    // out[i] = value of entry first + i, c[k] are all values of column k
+    using Kernel = void (*)(const double* const* c, std::size_t first, std::size_t n, double* out);
+
+    // Empty if the expression uses anything else (arrays, specials, methods)
+    static std::optional<ColumnExpression> parse(const std::string& expression);
+
+    // Names in the order expected by evaluate
+    const std::vector<std::string>& columns() const;
+
+    // out[i] for entry first + i, columns[c] points to all values of column c
+    void evaluate(const std::vector<const double*>& columns, std::size_t first, std::size_t n, double* out) const;
+
+    // C++ expression of one entry i, reading column k as c[k][i]
+    std::string source() const;
+    // Native code for evaluate, see KernelCompiler
+    void setKernel(Kernel);
+    bool compiled() const;
+
+private:
+    enum class OpCode { COLUMN, CONSTANT, NEG, NOT, ADD, SUB, MUL, DIV, LT, LE, GT, GE, EQ, NE, AND, OR, FUNC1, FUNC2 };
+    struct Op {
+        OpCode code;
+        std::size_t column = 0;
+        double value = 0;
+        double (*func1)(double) = nullptr;
+        double (*func2)(double, double) = nullptr;
+        const char* name = nullptr; // C++ function of FUNC1 and FUNC2
+    };
+    class Parser;
+
+    std::vector<Op> m_program; // Postfix order
+    std::vector<std::string> m_columns;
+    std::size_t m_stackDepth = 0;
+    Kernel m_kernel = nullptr;
+};
+
+#endif // COLUMNEXPRESSION_H
@@ -5,6 +5,7 @@
 #include <tuple>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 #include "RootFile.h"
 
@@ -17,6 +18,8 @@ public:
 
     struct FirstDrawArg {
         FirstDrawArg(std::string ex);
+        // Trimmed, non-empty expressions of "a;b;c", drawn side by side in one pass
+        static std::vector<std::string> split(const std::string& expression);
         std::string expression;
         std::vector<double> limits;
         enum class LimitError {
@@ -24,10 +27,12 @@ public:
             LimitOrdering,
             LimitNumber,
             No3DHists,
-            InsufficientLimits
+            InsufficientLimits,
+            MultipleWithLimits
         };
         LimitError error_code = LimitError::NoError;
         bool hist2d = false;
+        bool multiple = false; // Several expressions separated by ';' 
     };
     using DrawArgs = std::tuple<FirstDrawArg, std::string, Option_t*, Long64_t, Long64_t>; // TTreePlayerArgs
 
@@ -56,7 +61,7 @@ private:
     std::string last_error;
     std::unordered_set<char> allowed_chars;
     std::vector<std::string> command_history;
-    std::vector<std::string> branch_names;
+    std::vector<std::string_view> branch_names;
     int curs_offset = 0;
     int nCommandsParsed = 0;
 
@@ -0,0 +1,134 @@
+#ifndef DRAWENGINE_H
+#define DRAWENGINE_H
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TFile.h"
+#include "TTree.h"
+#include "TVirtualTreePlayer.h"
+#include "AutoHistogram.h"
+#include "ColumnCache.h"
+#include "KernelCompiler.h"
+#include "SelectionCache.h"
+
+// Evaluates tree expressions entry by entry like TTree::Draw, but fills the
+// histogram in the same pass instead of keeping the values. Large trees are
+// split at cluster boundaries and filled on several threads. Scalar leaves
+// read once are kept as columns and later draws evaluate them from memory,
+// entries passing a selection are kept as bitmap and later draws with that
+// selection read only those.
+class DrawEngine {
+public:
+    // Histograms filled so far, entries processed and entries to process
+    using Progress = std::function<void(const std::vector<AutoHistogram>&, Long64_t processed, Long64_t total)>;
+    constexpr static std::chrono::milliseconds default_progress_interval{100};
+
+    // Thrown by draw when a stop was requested
+    struct Cancelled : std::runtime_error {
+        Cancelled() : std::runtime_error("Draw cancelled") { }
+    };
+
+    // Histogram of varexp ("x" or "y:x") for entries passing selection,
+    // selection values are used as weights. Limits fix the range of the axes
+    // (xmin, xmax[, ymin, ymax]). Throws std::runtime_error if a formula does
+    // not compile. Stop requests are checked between clusters. Progress is
+    // called on the drawing thread while the draw runs. A tree shared with
+    // other threads is read under io, one cluster at a time
+    AutoHistogram draw(TTree* tree, const std::string& varexp, const std::string& selection = "",
+                       const std::vector<double>& limits = {},
+                       Long64_t nentries = TVirtualTreePlayer::kMaxEntries, Long64_t firstentry = 0,
+                       std::stop_token stop = {}, const Progress& progress = {},
+                       std::recursive_mutex* io = nullptr) const;
+    // Several varexps in one pass over the entries, one histogram each
+    std::vector<AutoHistogram> draw(TTree* tree, const std::vector<std::string>& varexps, const std::string& selection,
+                                    const std::vector<double>& limits, Long64_t nentries, Long64_t firstentry,
+                                    std::stop_token stop = {}, const Progress& progress = {},
+                                    std::recursive_mutex* io = nullptr) const;
+
+    // Preview from a stratified random subset of about fraction of the
+    // clusters in the entry range
+    AutoHistogram sample(TTree* tree, const std::string& varexp, const std::string& selection,
+                         const std::vector<double>& limits, Long64_t nentries, Long64_t firstentry,
+                         double fraction, std::stop_token stop = {}, const Progress& progress = {},
+                         std::recursive_mutex* io = nullptr) const;
+    std::vector<AutoHistogram> sample(TTree* tree, const std::vector<std::string>& varexps,
+                                      const std::string& selection, const std::vector<double>& limits,
+                                      Long64_t nentries, Long64_t firstentry, double fraction,
+                                      std::stop_token stop = {}, const Progress& progress = {},
+                                      std::recursive_mutex* io = nullptr) const;
+
+    // Statistics of a numeric leaf over all values, also array elements
+    struct LeafSummary {
+        std::string name; // TLeaf::GetFullName
+        bool summarized = true; // False for objects, strings and other types that are not read
+        Long64_t entries = 0; // Finite values, the statistics are of these
+        Long64_t nonfinite = 0; // NaN and Inf
+        Long64_t zeros = 0;
+        double min = std::numeric_limits<double>::infinity();
+        double max = -std::numeric_limits<double>::infinity();
+        double mean = 0;
+        double m2 = 0; // Sum of squared deviations from the mean
+
+        // Standard deviation, like TH1::GetRMS
+        double rms() const;
+        double zeroFraction() const;
+        void merge(const LeafSummary&);
+    };
+    // Summaries of all numeric leaves of the tree in one pass, each branch is
+    // read once per entry, other leaves are listed as not summarized. Threads,
+    // stop requests and io as in draw, progress is called with entries
+    // processed and total
+    std::vector<LeafSummary> describe(TTree* tree, std::stop_token stop = {},
+                                      const std::function<void(Long64_t, Long64_t)>& progress = {},
+                                      std::recursive_mutex* io = nullptr) const;
+
+    // Same tree read through a new handle of its file, nullptr if the file
+    // can not be opened again
+    static TTree* openCopy(TTree* tree, std::unique_ptr<TFile>& file);
+
+    // Points kept in memory per histogram until its range is known
+    void setBufferSize(std::size_t);
+    std::size_t bufferSize() const;
+    // Number of fill threads, 0 for one per core
+    void setThreads(unsigned);
+    // Values of scalar leaves are kept here and reused by later draws,
+    // nullptr to always read the tree
+    void setColumnCache(ColumnCache*);
+    // Entries passing selections of scalar leaves are kept here, later draws
+    // with the same selection only read those. nullptr to always evaluate it
+    void setSelectionCache(SelectionCache*);
+    // Expressions of scalar leaves are compiled instead of interpreted by
+    // TTreeFormula, nullptr to keep the formulas
+    void setKernelCompiler(KernelCompiler*);
+    // Time between progress calls of a running draw
+    void setProgressInterval(std::chrono::milliseconds interval);
+
+private:
+    using EntryRange = std::pair<Long64_t, Long64_t>;
+    std::vector<AutoHistogram> fill(TTree* tree, const std::vector<std::string>& varexps,
+                                    const std::string& selection, const std::vector<double>& limits,
+                                    const std::vector<EntryRange>& ranges, std::stop_token stop,
+                                    const Progress& progress, std::recursive_mutex* io) const;
+    // Whole clusters, about equal number of entries per task
+    static std::vector<EntryRange> clusterTasks(TTree* tree, const std::vector<EntryRange>& ranges, int ntasks);
+    static std::vector<EntryRange> sampleClusters(TTree* tree, Long64_t first, Long64_t last, double fraction);
+    AutoHistogram makeHistogram(bool is2d, const std::vector<double>& limits) const;
+
+    std::size_t m_bufferSize = AutoHistogram::default_buffer;
+    unsigned m_threads = 0;
+    ColumnCache* m_columnCache = nullptr;
+    SelectionCache* m_selectionCache = nullptr;
+    KernelCompiler* m_kernels = nullptr;
+    std::chrono::milliseconds m_progressInterval = default_progress_interval;
+};
+
+#endif // DRAWENGINE_H
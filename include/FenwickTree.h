@@ -0,0 +1,27 @@
+#ifndef FENWICKTREE_H
+#define FENWICKTREE_H
+
+#include <vector>
+
+// Prefix sums over 0/1 flags with logarithmic update and k-th element lookup
+class FenwickTree {
+public:
+    // Build from flags in O(n)
+    void assign(const std::vector<int>& values);
+    void add(int i, int delta);
+
+    // Sum of elements [0, i)
+    int prefix(int i) const;
+    int total() const;
+    int size() const;
+
+    // Position of the k-th (0-based) element with value 1, size() if none
+    int find(int k) const;
+
+private:
+    std::vector<int> m_tree; // 1-based
+    int m_size = 0;
+    int m_highBit = 0;
+};
+
+#endif // FENWICKTREE_H
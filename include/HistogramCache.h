@@ -0,0 +1,41 @@
+#ifndef HISTOGRAMCACHE_H
+#define HISTOGRAMCACHE_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include "TTree.h"
+#include "AutoHistogram.h"
+#include "LruCache.h"
+
+// Everything that changes the content of a fill, display options never need
+// a refill
+struct HistogramKey {
+    const TTree* tree = nullptr;
+    std::string varexp;
+    std::string selection;
+    std::vector<double> limits;
+    Long64_t nentries = 0;
+    Long64_t firstentry = 0;
+    std::size_t bufferSize = 0; // Binning of the fine histogram
+    double sample = 1.0; // Fraction of clusters read, 1 for all
+
+    bool operator==(const HistogramKey&) const = default;
+};
+
+template <>
+struct std::hash<HistogramKey> {
+    std::size_t operator()(const HistogramKey&) const;
+};
+
+template <>
+struct CacheTraits<AutoHistogram> {
+    constexpr static std::size_t default_budget = std::size_t(256) << 20;
+    static std::size_t bytes(const AutoHistogram& hist) { return hist.memoryUsage(); }
+};
+
+// Filled histograms of recent draws
+using HistogramCache = LruCache<HistogramKey, AutoHistogram>;
+
+#endif // HISTOGRAMCACHE_H
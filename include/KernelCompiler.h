@@ -0,0 +1,22 @@
+#ifndef KERNELCOMPILER_H
+#define KERNELCOMPILER_H
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "ColumnExpression.h"
+
+// Compiles column expressions to native loops with the ROOT interpreter
+// (Cling). Each distinct expression is compiled once per session, compiling
+// takes a while, so it is only worth it for many entries.
+class KernelCompiler {
+public:
+    // Sets the kernel of expr, false if it could not be compiled
+    bool compile(ColumnExpression& expr);
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<std::string, ColumnExpression::Kernel> m_kernels; // By source, nullptr if failed
+};
+
+#endif // KERNELCOMPILER_H
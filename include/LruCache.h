@@ -0,0 +1,91 @@
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+// Memory use and default budget of a cached value type, specialized next to
+// each cache alias
+template <typename Value>
+struct CacheTraits;
+
+// Values keyed by K, least recently used ones are dropped when the memory
+// budget is exceeded. The newest value is kept even if it alone exceeds the
+// budget. Used from the draw threads, all calls are locked.
+template <typename K, typename V>
+class LruCache {
+public:
+    using Key = K;
+    using Value = V;
+    // Kept alive by the caller even if it is evicted meanwhile
+    using Entry = std::shared_ptr<const Value>;
+
+    // nullptr if not cached
+    Entry find(const Key& key) {
+        std::lock_guard lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it == m_index.end()) {
+            return nullptr;
+        }
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return it->second->second;
+    }
+
+    Entry insert(const Key& key, Value&& value) {
+        std::lock_guard lock(m_mutex);
+        if (auto it = m_index.find(key); it != m_index.end()) {
+            m_used -= CacheTraits<Value>::bytes(*it->second->second);
+            m_entries.erase(it->second);
+            m_index.erase(it);
+        }
+        m_entries.emplace_front(key, std::make_shared<const Value>(std::move(value)));
+        m_index.emplace(key, m_entries.begin());
+        m_used += CacheTraits<Value>::bytes(*m_entries.front().second);
+        evict();
+        return m_entries.front().second;
+    }
+
+    // Whether a value of this size would be kept next to others
+    bool fits(std::size_t bytes) const {
+        std::lock_guard lock(m_mutex);
+        return bytes <= m_budget;
+    }
+
+    void setBudget(std::size_t bytes) {
+        std::lock_guard lock(m_mutex);
+        m_budget = bytes;
+        evict();
+    }
+
+    void clear() {
+        std::lock_guard lock(m_mutex);
+        m_entries.clear();
+        m_index.clear();
+        m_used = 0;
+    }
+
+private:
+    using Item = std::pair<Key, Entry>;
+
+    void evict() {
+        while (m_used > m_budget && m_entries.size() > 1) {
+            auto& [key, value] = m_entries.back();
+            m_used -= CacheTraits<Value>::bytes(*value);
+            m_index.erase(key);
+            m_entries.pop_back();
+        }
+    }
+
+    mutable std::mutex m_mutex;
+    std::size_t m_budget = CacheTraits<Value>::default_budget;
+    std::size_t m_used = 0;
+    std::list<Item> m_entries; // Most recently used first
+    std::unordered_map<Key, typename std::list<Item>::iterator> m_index;
+};
+
+#endif // LRUCACHE_H
@@ -1,74 +1,274 @@
 #ifndef ROOTFILE_H
 #define ROOTFILE_H
 
+#include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <optional>
+#include <atomic>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include "TDirectory.h"
 #include "TTree.h"
+#include "TBranch.h"
 #include "TLeaf.h"
 #include "TH1.h"
 #include "TFile.h"
+#include "TKey.h"
+#include "FenwickTree.h"
+#include "StringPool.h"
+
+enum class NodeType { DIRECTORY, TTREE, BRANCH, TLEAF, HIST, UNKNOWN };
+
+// Node types that can be opened in the menu
+inline bool is_container(NodeType type) {
+    return type == NodeType::DIRECTORY || type == NodeType::TTREE || type == NodeType::BRANCH;
+}
+
+// Serializes reads from the shared TFile (indexing thread vs. UI thread)
+inline std::recursive_mutex root_io_mutex;
+
+// Object metadata when it is known without a TKey (structure cache)
+struct ObjectInfo {
+    std::string name;
+    std::string title;
+    std::string classname;
+    short cycle = 0;
+    Long64_t entries = -1; // TTree only
+};
+
+// Handle to a TObject stored in the file. Only the TKey metadata (or cached
+// metadata) is used until the object itself is needed, then it is read once and kept.
+// Cached metadata is owned by the RootFile, so a handle allocates nothing itself
+// as long as its locate function fits std::function's local storage
+template<typename T>
+class LazyObject {
+public:
+    explicit LazyObject(TKey* key) : m_key(key) { }
+    explicit LazyObject(T* obj) : m_obj(obj) { }
+    LazyObject(TKey* key, T* obj) : m_key(key), m_obj(obj) { }
+    LazyObject(const ObjectInfo* info, std::function<TObject*()> locate)
+        : m_info(info), m_locate(std::move(locate)) { }
+
+    T* get() {
+        if (m_obj == nullptr) {
+            std::lock_guard lock(root_io_mutex);
+            if (m_key != nullptr) {
+                m_obj = dynamic_cast<T*>(m_key->ReadObj());
+            }
+            else if (m_locate) {
+                m_obj = dynamic_cast<T*>(m_locate());
+            }
+        }
+        return m_obj;
+    }
+    T* operator->() { return get(); }
+    bool isLoaded() const { return m_obj != nullptr; }
+    const ObjectInfo* info() const { return m_info; }
+
+    const char* name() const {
+        return m_info ? m_info->name.c_str() : m_key ? m_key->GetName() : m_obj->GetName();
+    }
+    const char* title() const {
+        return m_info ? m_info->title.c_str() : m_key ? m_key->GetTitle() : m_obj->GetTitle();
+    }
+    const char* className() const {
+        return m_info ? m_info->classname.c_str() : m_key ? m_key->GetClassName() : m_obj->ClassName();
+    }
+    short cycle() const { return m_info ? m_info->cycle : m_key ? m_key->GetCycle() : 0; }
+
+private:
+    TKey* m_key = nullptr;
+    T* m_obj = nullptr;
+    const ObjectInfo* m_info = nullptr;
+    std::function<TObject*()> m_locate;
+};
 
-enum class NodeType { DIRECTORY, TTREE, TLEAF, HIST, UNKNOWN };
 class RootFile {
 public:
     RootFile() = default;
     ~RootFile();
     // Loads and labels a TFile directory structure. Must be called before
-    // everything else
-    void load(std::string filename);
+    // everything else. The structure is read from the index cache in cacheDir
+    // or indexed from the file in the background. notify() is called when new
+    // content is ready to be merged
+    void load(std::string filename, const std::filesystem::path& cacheDir, std::function<void()> notify);
+
+    // Attach background-indexed directories to the menu. Returns true if the
+    // menu changed. Must be called from the UI thread
+    bool mergeIndexed();
+    bool isIndexing() const;
+    // Number of indexed and discovered directories
+    std::pair<int, int> indexProgress() const;
+
+    using NodeId = int;
+    constexpr static NodeId no_node = -1;
+    constexpr static NodeId root_id = 0;
 
-    // TObject in ROOT file
+    // View of a TObject in ROOT file. Node data lives in RootFile's node store
     class Node final {
     public:
-        Node();
-        Node(NodeType nt, int idx, Node* mot, int nest);
+        Node() = default;
+        Node(const RootFile* file, NodeId id);
 
-        // Open/close directory. Toggles content visibility of folders and trees
-        void toggleOpenOnClick();
+        NodeType type() const; // TObject category
+        int index() const; // Logical pointer to storage
+        Node mother() const; // Tree or branch for leaves
+        int nesting() const; // for printing
+        bool isOpen() const;
+        bool isListed() const;
+        bool showInSearch() const; // When search active set to true if match
+        bool populated() const; // Children of trees and branches are created on first open, directories are indexed in background
 
-        NodeType type; // TObject category
-        int index = -1; // Logical pointer to storage
-        Node* mother = nullptr; // So leaves know their tree
-        std::vector<std::unique_ptr<Node>> nodes;
-
-        enum OpenState {DIR_OPEN = 0b10, LISTED = 0b01, DEFAULT=0b0};
-        std::uint8_t openState = DEFAULT;
-        int nesting = 0; // for printing
-        bool showInSearch = false; // When search active set to true if match
+        NodeId id() const;
+        bool operator==(const Node&) const = default;
 
     private:
-        void recurseOpen(bool open);
-    } root_node;
+        const RootFile* m_file = nullptr;
+        NodeId m_id = no_node;
+    };
 
-    using MenuItem = std::tuple<std::string, Node*>;
+    using MenuItem = std::tuple<std::string_view, Node>;
     // Return n-th listed RootFile element
     std::optional<MenuItem> getEntry(int, bool searchMode=false);
+    // Names are views into the string pool of this RootFile
     std::vector<MenuItem> displayList;
 
+    // Open/close a node, reading its content from file on first open
+    void toggleOpen(Node);
+
+    // Mark listed leaves containing pattern as search results (all leaves if
+    // empty). Leaves of trees not read yet are matched as readNextTree reaches them
+    void search(const std::string& pattern);
+
+    // Branches and leaves are listed when a tree or split branch is first
+    // opened or searched. The remaining ones are read one at a time while the
+    // UI is idle
+    bool hasUnreadTrees();
+    // Returns true if a tree or branch was read
+    bool readNextTree();
+    // Trees and split branches whose children are not listed yet
+    int unreadTrees() const;
+
+    // Index into m_trees of the tree a leaf or branch belongs to, -1 if none
+    int treeIndex(Node) const;
+
     // Name (title)
-    std::string toString(Node*);
+    std::string toString(Node);
     
     // Return number of elements to be displayed in gui
     int menuLength(bool searchMode);
 
     // Object address storage
-    std::vector<TDirectory*> m_directories;
-    std::vector<TTree*> m_trees;
-    std::vector<TLeaf*> m_leaves;
-    std::vector<TH1D*> m_histos_th1d;
-    std::vector<TObject*> m_unclassified;
+    std::vector<LazyObject<TDirectory>> m_directories;
+    std::vector<LazyObject<TTree>> m_trees;
+    std::vector<LazyObject<TBranch>> m_branches;
+    std::vector<LazyObject<TLeaf>> m_leaves;
+    std::vector<LazyObject<TH1D>> m_histos_th1d;
+    std::vector<LazyObject<TObject>> m_unclassified;
 
 private:
-    void traverseTFile(std::string& filename);
-    void traverseTFile(TDirectory*, RootFile::Node*, int depth=0);
-    void readBranches(RootFile::Node*, TTree*, int depth);
-    void populateMenu(Node*, int nesting=0);
+    // Struct of arrays, one element per node. Children are linked lists
+    // through firstChild/nextSibling, so nodes need no allocations of their own
+    struct NodeStore {
+        enum Flags : std::uint8_t {
+            LISTED = 0b0001, DIR_OPEN = 0b0010, SEARCH_MATCH = 0b0100, POPULATED = 0b1000
+        };
+        std::vector<NodeType> type;
+        std::vector<std::uint8_t> flags;
+        std::vector<std::uint16_t> nesting;
+        std::vector<NodeId> parent;
+        std::vector<NodeId> firstChild;
+        std::vector<NodeId> lastChild;
+        std::vector<NodeId> nextSibling;
+        std::vector<int> index;
+        std::vector<int> menuIndex; // Position in displayList
+        std::vector<std::string_view> name;
+
+        int unread = 0; // Trees and branches not populated
+
+        NodeId add(NodeType, int idx, NodeId mother, int nest, std::string_view nodeName);
+        void setPopulated(NodeId);
+        bool has(NodeId id, std::uint8_t flag) const { return flags[id] & flag; }
+        std::size_t size() const { return type.size(); }
+    } m_nodes;
+
+    // Open/close directory. Toggles content visibility of folders and trees
+    // and keeps the count of listed menu entries up to date
+    void toggleOpenOnClick(NodeId);
+    void recurseOpen(NodeId, bool open);
+
+    // Content of one directory, read by the indexing thread. The worker does
+    // not touch the node store, nodes it creates are referred to by pending ids
+    struct IndexedKey {
+        NodeType type = NodeType::UNKNOWN;
+        int pendingId = -1; // Set for directories and trees
+        TKey* key = nullptr;
+        TDirectory* dir = nullptr; // Subdirectories are read during indexing
+        std::optional<ObjectInfo> info; // Set instead of key if read from cache
+        std::string path; // Location in file if read from cache
+    };
+    struct IndexBatch {
+        int mother = 0; // Pending id, 0 is the top directory
+        int depth = 0;
+        std::vector<IndexedKey> entries;
+    };
+
+    void openTFile(std::string& filename);
+    void indexFile();
+    IndexBatch indexDirectory(TDirectory*, int mother, int depth);
+    void indexSubdirectories(std::deque<std::tuple<TDirectory*, int, int>> pending);
+    void publish(std::vector<IndexBatch>&& batches);
+    void attachBatch(IndexBatch&);
+
+    // Structure cache
+    bool readIndexCache();
+    void writeIndexCache();
+    void readBranches(NodeId, TObjArray* branches, int depth);
+    void populateTree(NodeId);
+    // Flags a leaf attached while a search is active
+    void markSearchMatch(NodeId);
+    void insertMenuItems(NodeId mother);
+    const char* nodeName(NodeType, int index);
+    void populateMenu(NodeId);
     void populateMenu();
-    void openObviousDirectory(Node*);
+    void rebuildMenuIndex();
+    void openObviousDirectory(NodeId);
 
     std::unique_ptr<TFile> m_tfile;
+    StringPool m_names;
+    std::deque<ObjectInfo> m_cachedInfo; // Metadata of objects read from the cache, stable addresses
+
+    // Visible entries of displayList for normal and search mode
+    FenwickTree m_listedIndex;
+    FenwickTree m_searchIndex;
+
+    // Background indexing
+    std::thread m_indexer;
+    std::function<void()> m_notify;
+    std::mutex m_batch_mutex;
+    std::vector<IndexBatch> m_batches;
+    std::atomic<bool> m_indexing = false;
+    std::atomic<bool> m_stopIndexing = false;
+    std::atomic<int> m_dirsFound = 0;
+    std::atomic<int> m_dirsIndexed = 0;
+    int m_nextPendingId = 1; // Indexing thread only
+    std::vector<NodeId> m_pendingNodes; // Pending id -> node, UI thread only
+    NodeId m_obviousNode = no_node; // Keep opening obvious directories once indexed
+    NodeId m_unreadTree = 0; // All trees and branches before this node have been read
+    std::string m_searchPattern; // Last search, applied to nodes attached later
+
+    // Cache is keyed by file UUID (file name), size and modification time
+    std::filesystem::path m_cacheFile;
+    std::uintmax_t m_fileSize = 0;
+    long long m_fileMtime = 0;
+    std::atomic<bool> m_cacheOutdated = false; // Indexed from file or trees opened since last write
+    std::thread m_cacheWriter;
+    std::atomic<bool> m_cacheWriting = false;
 };
 
 #endif // ROOTFILE_H
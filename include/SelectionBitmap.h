@@ -0,0 +1,55 @@
+#ifndef SELECTIONBITMAP_H
+#define SELECTIONBITMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "RtypesCore.h"
+
+// Set of entry numbers, compressed like a roaring bitmap. Entries are grouped
+// into chunks of 2^16 by their upper bits, a chunk is a sorted list of the
+// lower bits while sparse and a bit set once that is smaller.
+class SelectionBitmap {
+public:
+    // Entries must be added in increasing order
+    void add(Long64_t entry);
+
+    bool contains(Long64_t entry) const;
+    Long64_t count() const;
+    // Whether an entry in [first, last) is set
+    bool any(Long64_t first, Long64_t last) const;
+    // Appends the entries in [first, last) to out, in increasing order
+    void entries(Long64_t first, Long64_t last, std::vector<Long64_t>& out) const;
+
+    static SelectionBitmap intersect(const SelectionBitmap&, const SelectionBitmap&);
+    static SelectionBitmap unite(const SelectionBitmap&, const SelectionBitmap&);
+
+    std::size_t bytes() const;
+
+private:
+    constexpr static int chunk_bits = 16;
+    constexpr static std::size_t chunk_words = (std::size_t(1) << chunk_bits) / 64;
+    // A list this long takes as much memory as the bit set
+    constexpr static std::size_t max_array = 4096;
+
+    struct Chunk {
+        Long64_t key = 0; // entry >> chunk_bits
+        std::vector<std::uint16_t> array; // Sorted lower bits, if bits is empty
+        std::vector<std::uint64_t> bits; // chunk_words words, if dense
+        std::size_t cardinality = 0;
+
+        bool contains(std::uint16_t low) const;
+        bool any(unsigned lo, unsigned hi) const;
+        // Lower bits in [lo, hi) appended as entries of this chunk
+        void entries(unsigned lo, unsigned hi, std::vector<Long64_t>& out) const;
+        // Representation that fits the cardinality
+        void normalize();
+    };
+    // Lower bit range of chunk within [first, last)
+    static std::pair<unsigned, unsigned> lowRange(const Chunk&, Long64_t first, Long64_t last);
+
+    std::vector<Chunk> m_chunks; // Sorted by key, none empty
+};
+
+#endif // SELECTIONBITMAP_H
@@ -0,0 +1,24 @@
+#ifndef SELECTIONCACHE_H
+#define SELECTIONCACHE_H
+
+#include <cstddef>
+#include <string>
+#include "LruCache.h"
+#include "SelectionBitmap.h"
+
+// Entries passing a drawn selection
+struct CachedSelection {
+    SelectionBitmap passed;
+    bool unitWeights = true; // Every passing entry has weight 1
+};
+
+template <>
+struct CacheTraits<CachedSelection> {
+    constexpr static std::size_t default_budget = std::size_t(64) << 20;
+    static std::size_t bytes(const CachedSelection& selection) { return selection.passed.bytes(); }
+};
+
+// Recently drawn selections, keyed by file, tree and cut
+using SelectionCache = LruCache<std::string, CachedSelection>;
+
+#endif // SELECTIONCACHE_H
@@ -0,0 +1,27 @@
+#ifndef SIMDKERNELS_H
+#define SIMDKERNELS_H
+
+#include <cstddef>
+
+// Vectorized loops over blocks of values for AutoHistogram. AVX2 or SSE4.1
+// is picked at runtime on x86-64, other CPUs use the scalar versions.
+namespace simd {
+    struct Range {
+        double min;
+        double max;
+        bool finite; // False if there is a NaN or Inf, min and max are unusable then
+    };
+    Range minMax(const double* x, std::size_t n);
+
+    // Automatic binning, bin = floor(x * scale) - offset. Bins outside
+    // [0, nbins) are set to -1
+    void scaledBins(const double* x, std::size_t n, double scale, double offset, int nbins, int* bins);
+    // Fixed range, bin = (x - lo) / (hi - lo) * nbins. Values outside [lo, hi]
+    // are set to -1, hi itself goes to the last bin
+    void rangeBins(const double* x, std::size_t n, double lo, double hi, int nbins, int* bins);
+
+    // hist[bins[i]] += w[i] (1 if w is nullptr), bins of -1 are skipped
+    void accumulate(const int* bins, const double* w, std::size_t n, double* hist);
+}
+
+#endif // SIMDKERNELS_H
@@ -0,0 +1,25 @@
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Interned, immutable strings stored back to back in large blocks. Returned
+// views stay valid for the lifetime of the pool
+class StringPool {
+public:
+    std::string_view intern(std::string_view str);
+    std::size_t size() const; // Number of distinct strings
+
+private:
+    constexpr static std::size_t block_size = 1 << 16;
+
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    std::vector<std::unique_ptr<char[]>> m_large;
+    std::size_t m_blockUsed = block_size;
+    std::unordered_set<std::string_view> m_strings;
+};
+
+#endif // STRINGPOOL_H
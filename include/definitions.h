@@ -3,7 +3,11 @@
 
 #include <cstdint>
 #include <array>
+#include <bit>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #ifndef NATIVE_FORMAT
 #define NATIVE_FORMAT 1
@@ -16,7 +20,7 @@
     #define fmtstring(...) fmt::format(__VA_ARGS__)
 #endif
 
-inline bool string_contains(const std::string& str, const std::string& x) {
+inline bool string_contains(std::string_view str, std::string_view x) {
 #if __cplusplus>=202302L
     return str.contains(x);
 #else
@@ -24,8 +28,87 @@ inline bool string_contains(const std::string& str, const std::string& x) {
 #endif
 }
 
+// NaN and Inf have all exponent bits set. Unlike std::isfinite this is not
+// folded to true under -ffinite-math-only, which -Ofast enables
+inline bool is_finite(double x) {
+    constexpr std::uint64_t exponent = 0x7FF0000000000000;
+    return (std::bit_cast<std::uint64_t>(x) & exponent) != exponent;
+}
+
+// Dimensions of a varexp as written, "y:x" gives {"y", "x"}. Only single
+// colons outside parentheses and brackets separate, "::" and the ':' of a
+// ternary "c ? a : b" do not
+inline std::vector<std::string> split_varexp(std::string_view varexp) {
+    std::vector<std::string> parts;
+    int depth = 0;
+    int ternary = 0; // Open '?' at depth 0
+    std::size_t begin = 0;
+    for (std::size_t i = 0; i < varexp.size(); ++i) {
+        const char c = varexp[i];
+        if (c == '(' || c == '[') {
+            depth++;
+        }
+        else if (c == ')' || c == ']') {
+            depth--;
+        }
+        else if (c == ':' && i + 1 < varexp.size() && varexp[i + 1] == ':') {
+            ++i; // Scope operator
+        }
+        else if (depth == 0 && c == '?') {
+            ternary++;
+        }
+        else if (depth == 0 && c == ':') {
+            if (ternary > 0) {
+                ternary--;
+                continue;
+            }
+            parts.emplace_back(varexp.substr(begin, i - begin));
+            begin = i + 1;
+        }
+    }
+    parts.emplace_back(varexp.substr(begin));
+    return parts;
+}
+
+// Operands of a selection "a && b && c" joined at the top level. Empty if
+// there is no top-level "&&", and also if there is a top-level "||" or "?",
+// which bind weaker: "a && b || c" is "(a && b) || c"
+inline std::vector<std::string> split_conjunction(std::string_view cut) {
+    std::vector<std::string> parts;
+    int depth = 0;
+    std::size_t begin = 0;
+    for (std::size_t i = 0; i < cut.size(); ++i) {
+        const char c = cut[i];
+        const bool twice = i + 1 < cut.size() && cut[i + 1] == c;
+        if (c == '(' || c == '[') {
+            depth++;
+        }
+        else if (c == ')' || c == ']') {
+            depth--;
+        }
+        else if (depth == 0 && (c == '?' || (c == '|' && twice))) {
+            return {};
+        }
+        else if (depth == 0 && c == '&' && twice) {
+            parts.emplace_back(cut.substr(begin, i - begin));
+            begin = i + 2;
+            ++i;
+        }
+    }
+    if (parts.empty()) {
+        return {};
+    }
+    parts.emplace_back(cut.substr(begin));
+    return parts;
+}
+
 inline constexpr double minimum_log_bin = 0.5;
 
+// Messages sent through the main loop wakeup pipe
+inline constexpr char notify_resize = 'R';
+inline constexpr char notify_index = 'I';
+inline constexpr char notify_draw = 'D';
+
 inline constexpr std::array<const char[4], 8>  ascii_2x2 { "▖", "▗", "▄", "▌", "▐", "▙", "▟", "█" };
 inline constexpr std::array<const char[5], 16> ascii_3x2 { "🬏", "🬞", "🬭", "🬱", "🬵", "🬹", "🬓", "🬦", "▌", "▐", "🬲", "🬷", "🬺", "🬻", "█"};
 inline constexpr std::array<const char[5], 24> ascii_4x2 { 
@@ -224,6 +307,8 @@ enum TermColor {
     #define SYMB_FOLDER_OPEN ""
     #define SYMB_FOLDER_CLOSED ""
     #define SYMB_TTREE ""
+    #define SYMB_BRANCH_OPEN "▾"
+    #define SYMB_BRANCH_CLOSED "▸"
     #define SYMB_TLEAF ""
     #define SYMB_THIST ""
     #define SYMB_TUNKNOWN "?"
@@ -232,6 +317,8 @@ enum TermColor {
     #define SYMB_FOLDER_OPEN "f"
     #define SYMB_FOLDER_CLOSED "F"
     #define SYMB_TTREE "T"
+    #define SYMB_BRANCH_OPEN "b"
+    #define SYMB_BRANCH_CLOSED "B"
     #define SYMB_TLEAF ","
     #define SYMB_THIST "h"
     #define SYMB_TUNKNOWN "?"
@@ -0,0 +1,569 @@
+#include "AutoHistogram.h"
+#include "SimdKernels.h"
+#include "definitions.h"
+#include <algorithm>
+#include <cmath>
+
+// Smallest exponent a bin width can start from
+static constexpr int min_exponent = std::numeric_limits<double>::min_exponent - std::numeric_limits<double>::digits;
+
+static long long floorShift(long long bin, int shift) {
+    // Bin index at a width 2^shift times larger, floor division also for negative bins
+    if (shift >= 62) {
+        return bin < 0 ? -1 : 0;
+    }
+    return bin >> shift;
+}
+
+long long AutoHistogram::Axis::globalBin(double x, int e) const {
+    return std::floor(std::ldexp(x, -e));
+}
+
+int AutoHistogram::Axis::fitExponent(int e, double from, double to) const {
+    // Smallest width of at least 2^e with [from, to] inside nbins bins
+    const double span = to - from;
+    const double magnitude = std::max(std::abs(from), std::abs(to));
+    if (span > 0) {
+        e = std::max(e, std::ilogb(span / nbins));
+    }
+    else if (magnitude > 0) {
+        e = std::max(e, std::ilogb(magnitude) - 20);
+    }
+    if (magnitude > 0) {
+        // Keep bin indices exact
+        e = std::max(e, std::ilogb(magnitude) - std::numeric_limits<double>::digits + 1);
+    }
+    while (globalBin(to, e) - globalBin(from, e) >= nbins) {
+        e++;
+    }
+    return e;
+}
+
+int AutoHistogram::Axis::bin(double x) const {
+    if (fixed) {
+        const int i = (x - lo) / (hi - lo) * nbins;
+        return std::clamp(i, 0, nbins - 1);
+    }
+    const long long i = globalBin(x, exp) - offset;
+    return i < 0 ? -1 : i >= nbins ? nbins : static_cast<int>(i);
+}
+
+std::pair<double, double> AutoHistogram::Axis::edges(int i) const {
+    if (fixed) {
+        return {lo + i * (hi - lo) / nbins, lo + (i + 1) * (hi - lo) / nbins};
+    }
+    return {std::ldexp(static_cast<double>(offset + i), exp), std::ldexp(static_cast<double>(offset + i + 1), exp)};
+}
+
+AutoHistogram::AutoHistogram(int dims, std::size_t bufferSize) : m_dims(dims), m_bufferSize(bufferSize) {
+    if (m_dims == 2) {
+        m_axes[0].nbins = default_bins_2d;
+        m_axes[1].nbins = default_bins_2d;
+    }
+    else {
+        m_axes[1].nbins = 1;
+    }
+}
+
+void AutoHistogram::setRange(int axis, double min, double max) {
+    m_axes[axis].fixed = true;
+    m_axes[axis].lo = min;
+    m_axes[axis].hi = max;
+    if (std::all_of(m_axes.begin(), m_axes.begin() + m_dims, [](const Axis& a) { return a.fixed; })) {
+        // Nothing to find out
+        m_bins.assign(m_axes[0].nbins * m_axes[1].nbins, 0);
+    }
+}
+
+void AutoHistogram::fill(double x, double w) {
+    const double v[2] = {x, 0};
+    fillPoint(v, w);
+}
+
+void AutoHistogram::fill(double x, double y, double w) {
+    const double v[2] = {x, y};
+    fillPoint(v, w);
+}
+
+void AutoHistogram::fill(std::size_t n, const double* x, const double* y, const double* w) {
+    const double* v[2] = {x, y};
+    auto fillPoints = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            const double point[2] = {x[i], m_dims == 2 ? y[i] : 0};
+            fillPoint(point, w != nullptr ? w[i] : 1.0);
+        }
+    };
+    // Until the bins are laid out points go to the buffer one by one
+    std::size_t first = 0;
+    for (; first < n && m_bins.empty(); ++first) {
+        fillPoints(first, first + 1);
+    }
+    if (first == n) {
+        return;
+    }
+    n -= first;
+    x += first;
+    y = y != nullptr ? y + first : nullptr;
+    w = w != nullptr ? w + first : nullptr;
+    v[0] = x;
+    v[1] = y;
+
+    // Mixed fixed and automatic axes, NaN, Inf and bin widths out of double
+    // range take the per point path
+    const bool fixed = m_axes[0].fixed;
+    bool vectorized = m_dims == 1 || m_axes[1].fixed == fixed;
+    simd::Range range[2];
+    for (int a = 0; a < m_dims && vectorized; ++a) {
+        range[a] = simd::minMax(v[a], n);
+        vectorized = range[a].finite;
+    }
+    if (!vectorized) {
+        fillPoints(0, n);
+        return;
+    }
+    if (!fixed) {
+        for (int a = 0; a < m_dims; ++a) {
+            Axis& axis = m_axes[a];
+            axis.min = std::min(axis.min, range[a].min);
+            axis.max = std::max(axis.max, range[a].max);
+            if (axis.bin(range[a].min) < 0 || axis.bin(range[a].max) >= axis.nbins) {
+                // Values that would widen the bins too much are placed one by one
+                // below, they may be kept aside
+                const double lo = std::min(axis.low, range[a].min);
+                const double hi = std::max(axis.high, range[a].max);
+                if (const int exp = axis.fitExponent(axis.exp, lo, hi); exp - axis.exp < outlier_widening) {
+                    widen(a, exp, lo);
+                }
+            }
+            if (axis.exp < -std::numeric_limits<double>::max_exponent + 1) {
+                // Values near the smallest doubles, 2^-exp overflows
+                fillPoints(0, n);
+                return;
+            }
+        }
+    }
+
+    std::vector<int> bins[2];
+    for (int a = 0; a < m_dims; ++a) {
+        const Axis& axis = m_axes[a];
+        bins[a].resize(n);
+        if (fixed) {
+            simd::rangeBins(v[a], n, axis.lo, axis.hi, axis.nbins, bins[a].data());
+        }
+        else {
+            simd::scaledBins(v[a], n, std::ldexp(1.0, -axis.exp), axis.offset, axis.nbins, bins[a].data());
+        }
+    }
+
+    // Values outside a fixed range are ignored like in fillPoint, outside
+    // automatic bins they are inserted after the others
+    std::vector<std::size_t> outside;
+    for (std::size_t i = 0; i < n; ++i) {
+        const bool inside = bins[0][i] >= 0 && (m_dims == 1 || bins[1][i] >= 0);
+        if (fixed && !inside) {
+            bins[0][i] = -1;
+            continue;
+        }
+        const double weight = w != nullptr ? w[i] : 1.0;
+        m_entries++;
+        m_sumw += weight;
+        m_sumw2 += weight * weight;
+        for (int a = 0; a < m_dims; ++a) {
+            Axis& axis = m_axes[a];
+            axis.sumwx += weight * v[a][i];
+            axis.sumwx2 += weight * v[a][i] * v[a][i];
+            if (fixed) {
+                axis.min = std::min(axis.min, v[a][i]);
+                axis.max = std::max(axis.max, v[a][i]);
+            }
+        }
+        if (m_dims == 2) {
+            m_sumwxy += weight * x[i] * y[i];
+        }
+        if (!inside) {
+            outside.push_back(i);
+            bins[0][i] = -1;
+        }
+        else if (m_dims == 2) {
+            bins[0][i] = cell(bins[0][i], bins[1][i]);
+        }
+    }
+    simd::accumulate(bins[0].data(), w, n, m_bins.data());
+
+    if (!fixed) {
+        for (int a = 0; a < m_dims; ++a) {
+            Axis& axis = m_axes[a];
+            if (outside.empty()) {
+                axis.low = std::min(axis.low, range[a].min);
+                axis.high = std::max(axis.high, range[a].max);
+                continue;
+            }
+            for (std::size_t i = 0; i < n; ++i) {
+                if (bins[0][i] >= 0) {
+                    axis.low = std::min(axis.low, v[a][i]);
+                    axis.high = std::max(axis.high, v[a][i]);
+                }
+            }
+        }
+    }
+    for (const std::size_t i : outside) {
+        const double point[2] = {x[i], m_dims == 2 ? y[i] : 0};
+        insert(point, w != nullptr ? w[i] : 1.0);
+    }
+}
+
+void AutoHistogram::fillPoint(const double* v, double w) {
+    for (int a = 0; a < m_dims; ++a) {
+        if (!is_finite(v[a])) {
+            m_nonFinite++;
+            return;
+        }
+    }
+    for (int a = 0; a < m_dims; ++a) {
+        if (m_axes[a].fixed && (v[a] < m_axes[a].lo || v[a] > m_axes[a].hi)) {
+            return;
+        }
+    }
+    m_entries++;
+    m_sumw += w;
+    m_sumw2 += w * w;
+    for (int a = 0; a < m_dims; ++a) {
+        Axis& axis = m_axes[a];
+        axis.sumwx += w * v[a];
+        axis.sumwx2 += w * v[a] * v[a];
+        axis.min = std::min(axis.min, v[a]);
+        axis.max = std::max(axis.max, v[a]);
+    }
+    if (m_dims == 2) {
+        m_sumwxy += w * v[0] * v[1];
+    }
+    insert(v, w);
+}
+
+void AutoHistogram::merge(const AutoHistogram& other) {
+    m_entries += other.m_entries;
+    m_nonFinite += other.m_nonFinite;
+    m_sumw += other.m_sumw;
+    m_sumw2 += other.m_sumw2;
+    m_sumwxy += other.m_sumwxy;
+    for (int a = 0; a < m_dims; ++a) {
+        m_axes[a].sumwx += other.m_axes[a].sumwx;
+        m_axes[a].sumwx2 += other.m_axes[a].sumwx2;
+        m_axes[a].min = std::min(m_axes[a].min, other.m_axes[a].min);
+        m_axes[a].max = std::max(m_axes[a].max, other.m_axes[a].max);
+    }
+
+    const int stride = m_dims + 1;
+    if (other.m_bins.empty()) {
+        for (std::size_t p = 0; p < other.m_buffer.size(); p += stride) {
+            insert(&other.m_buffer[p], other.m_buffer[p + m_dims]);
+        }
+        return;
+    }
+    if (m_bins.empty()) {
+        // Take over the binning, then add own buffer
+        auto buffer = std::move(m_buffer);
+        m_buffer.clear();
+        for (int a = 0; a < m_dims; ++a) {
+            m_axes[a].exp = other.m_axes[a].exp;
+            m_axes[a].offset = other.m_axes[a].offset;
+            m_axes[a].low = other.m_axes[a].low;
+            m_axes[a].high = other.m_axes[a].high;
+        }
+        m_bins = other.m_bins;
+        for (std::size_t p = 0; p < buffer.size(); p += stride) {
+            insert(&buffer[p], buffer[p + m_dims]);
+        }
+        mergeOutliers(other);
+        return;
+    }
+
+    // Common width covering both, aligned bins merge exactly
+    for (int a = 0; a < m_dims; ++a) {
+        Axis& axis = m_axes[a];
+        if (!axis.fixed) {
+            const double lo = std::min(axis.low, other.m_axes[a].low);
+            const double hi = std::max(axis.high, other.m_axes[a].high);
+            widen(a, axis.fitExponent(std::max(axis.exp, other.m_axes[a].exp), lo, hi), lo);
+            axis.low = lo;
+            axis.high = hi;
+        }
+    }
+    auto target = [this, &other](int a, int i) -> int {
+        if (m_axes[a].fixed || a >= m_dims) {
+            return i;
+        }
+        return floorShift(other.m_axes[a].offset + i, m_axes[a].exp - other.m_axes[a].exp) - m_axes[a].offset;
+    };
+    for (int iy = 0; iy < m_axes[1].nbins; ++iy) {
+        for (int ix = 0; ix < m_axes[0].nbins; ++ix) {
+            if (const double content = other.m_bins[other.cell(ix, iy)]; content != 0) {
+                m_bins[cell(target(0, ix), target(1, iy))] += content;
+            }
+        }
+    }
+    mergeOutliers(other);
+}
+
+void AutoHistogram::mergeOutliers(const AutoHistogram& other) {
+    for (const auto& [point, weight] : other.m_outliers) {
+        const double x[2] = {point.first, point.second};
+        insert(x, weight);
+    }
+}
+
+int AutoHistogram::dimension() const {
+    return m_dims;
+}
+
+Long64_t AutoHistogram::entries() const {
+    return m_entries;
+}
+
+bool AutoHistogram::empty() const {
+    return m_entries == 0;
+}
+
+double AutoHistogram::min(int axis) const {
+    return m_axes[axis].min;
+}
+
+double AutoHistogram::max(int axis) const {
+    return m_axes[axis].max;
+}
+
+Long64_t AutoHistogram::nonFinite() const {
+    return m_nonFinite;
+}
+
+std::size_t AutoHistogram::memoryUsage() const {
+    // Map nodes take about four pointers besides the point
+    constexpr std::size_t node = sizeof(decltype(m_outliers)::value_type) + 4 * sizeof(void*);
+    return sizeof(*this) + (m_bins.capacity() + m_buffer.capacity()) * sizeof(double) + m_outliers.size() * node;
+}
+
+double AutoHistogram::quantile(double q, int axis) const {
+    // Buffered and kept aside values are exact, weight in fine bins is spread
+    // evenly over the bin
+    const Axis& ax = m_axes[axis];
+    const int stride = m_dims + 1;
+    std::vector<std::pair<double, double>> exact;
+    for (std::size_t p = 0; p < m_buffer.size(); p += stride) {
+        exact.emplace_back(m_buffer[p + axis], m_buffer[p + m_dims]);
+    }
+    for (const auto& [point, weight] : m_outliers) {
+        exact.emplace_back(axis == 0 ? point.first : point.second, weight);
+    }
+    std::sort(exact.begin(), exact.end());
+    std::vector<double> marginal(m_bins.empty() ? 0 : ax.nbins);
+    for (int iy = 0; iy < m_axes[1].nbins && !m_bins.empty(); ++iy) {
+        for (int ix = 0; ix < m_axes[0].nbins; ++ix) {
+            marginal[axis == 0 ? ix : iy] += m_bins[cell(ix, iy)];
+        }
+    }
+
+    double total = 0;
+    for (const auto& [value, weight] : exact) {
+        total += weight;
+    }
+    for (const double content : marginal) {
+        total += content;
+    }
+    if (!(total > 0)) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    const double target = std::clamp(q, 0.0, 1.0) * total;
+    double below = 0;
+    std::size_t next = 0;
+    for (int i = 0; i < static_cast<int>(marginal.size()); ++i) {
+        const auto [lo, hi] = ax.edges(i);
+        for (; next < exact.size() && exact[next].first < lo; ++next) {
+            below += exact[next].second;
+            if (below >= target) {
+                return exact[next].first;
+            }
+        }
+        if (marginal[i] > 0 && below + marginal[i] >= target) {
+            return std::clamp(lo + (target - below) / marginal[i] * (hi - lo), ax.min, ax.max);
+        }
+        below += marginal[i];
+    }
+    for (; next < exact.size(); ++next) {
+        below += exact[next].second;
+        if (below >= target) {
+            return exact[next].first;
+        }
+    }
+    return ax.max;
+}
+
+std::pair<double, double> AutoHistogram::alignedRange(int axis, double min, double max, int nbins) const {
+    const Axis& ax = m_axes[axis];
+    if (m_bins.empty() || !(max > min) || nbins < 1) {
+        return {min, max};
+    }
+    // Start on the fine bin edge below min, then widen display bins by whole fine bins
+    const auto [origin, next] = ax.edges(0);
+    const double width = next - origin;
+    const double first = origin + std::floor((min - origin) / width) * width;
+    const double perBin = std::max(1.0, std::ceil((max - first) / (nbins * width)));
+    return {first, first + nbins * perBin * width};
+}
+
+void AutoHistogram::project(TH1D& hist) const {
+    for (const auto& [point, weight] : m_outliers) {
+        hist.Fill(point.first, weight);
+    }
+    if (m_bins.empty()) {
+        for (std::size_t p = 0; p < m_buffer.size(); p += 2) {
+            hist.Fill(m_buffer[p], m_buffer[p + 1]);
+        }
+    }
+    else {
+        for (int ix = 0; ix < m_axes[0].nbins; ++ix) {
+            if (const double content = m_bins[ix]; content != 0) {
+                hist.AddBinContent(displayBin(0, ix, hist.GetXaxis()), content);
+            }
+        }
+    }
+    double stats[4] = {m_sumw, m_sumw2, m_axes[0].sumwx, m_axes[0].sumwx2};
+    hist.PutStats(stats);
+    hist.SetEntries(m_entries);
+}
+
+void AutoHistogram::project(TH2D& hist) const {
+    for (const auto& [point, weight] : m_outliers) {
+        hist.Fill(point.first, point.second, weight);
+    }
+    if (m_bins.empty()) {
+        for (std::size_t p = 0; p < m_buffer.size(); p += 3) {
+            hist.Fill(m_buffer[p], m_buffer[p + 1], m_buffer[p + 2]);
+        }
+    }
+    else {
+        std::vector<int> binx(m_axes[0].nbins);
+        for (int ix = 0; ix < m_axes[0].nbins; ++ix) {
+            binx[ix] = displayBin(0, ix, hist.GetXaxis());
+        }
+        for (int iy = 0; iy < m_axes[1].nbins; ++iy) {
+            const int biny = displayBin(1, iy, hist.GetYaxis());
+            for (int ix = 0; ix < m_axes[0].nbins; ++ix) {
+                if (const double content = m_bins[cell(ix, iy)]; content != 0) {
+                    hist.AddBinContent(hist.GetBin(binx[ix], biny), content);
+                }
+            }
+        }
+    }
+    double stats[7] = {m_sumw, m_sumw2, m_axes[0].sumwx, m_axes[0].sumwx2,
+                       m_axes[1].sumwx, m_axes[1].sumwx2, m_sumwxy};
+    hist.PutStats(stats);
+    hist.SetEntries(m_entries);
+}
+
+void AutoHistogram::insert(const double* x, double w) {
+    if (m_bins.empty()) {
+        m_buffer.insert(m_buffer.end(), x, x + m_dims);
+        m_buffer.push_back(w);
+        if (m_buffer.size() >= m_bufferSize * (m_dims + 1)) {
+            flush();
+        }
+        return;
+    }
+    int index[2] = {0, 0};
+    for (int a = 0; a < m_dims; ++a) {
+        Axis& axis = m_axes[a];
+        index[a] = axis.bin(x[a]);
+        if (index[a] >= 0 && index[a] < axis.nbins) {
+            continue;
+        }
+        const double lo = std::min(axis.low, x[a]);
+        const double hi = std::max(axis.high, x[a]);
+        const int exp = axis.fitExponent(axis.exp, lo, hi);
+        const std::pair point(x[0], m_dims == 2 ? x[1] : 0);
+        if (exp - axis.exp >= outlier_widening && (m_outliers.size() < max_outliers || m_outliers.contains(point))) {
+            // E.g. a sentinel value would squeeze everything else into one bin
+            m_outliers[point] += w;
+            return;
+        }
+        widen(a, exp, lo);
+        index[a] = axis.bin(x[a]);
+    }
+    for (int a = 0; a < m_dims; ++a) {
+        m_axes[a].low = std::min(m_axes[a].low, x[a]);
+        m_axes[a].high = std::max(m_axes[a].high, x[a]);
+    }
+    m_bins[cell(index[0], index[1])] += w;
+}
+
+void AutoHistogram::flush() {
+    // Lay out bins over the buffered range
+    if (!m_bins.empty() || m_buffer.empty()) {
+        return;
+    }
+    const int stride = m_dims + 1;
+    for (int a = 0; a < m_dims; ++a) {
+        Axis& axis = m_axes[a];
+        if (axis.fixed) {
+            continue;
+        }
+        std::vector<double> values;
+        for (std::size_t p = 0; p < m_buffer.size(); p += stride) {
+            values.push_back(m_buffer[p + a]);
+        }
+        std::sort(values.begin(), values.end());
+        // Over all values, unless a few extreme ones on either side would make
+        // the bins much wider. Those are kept aside when inserted
+        const std::size_t k = std::min(values.size() / 100, max_outliers / 4);
+        double lo = values.front();
+        double hi = values.back();
+        axis.exp = axis.fitExponent(min_exponent, lo, hi);
+        if (const int core = axis.fitExponent(min_exponent, values[k], values[values.size() - 1 - k]);
+            axis.exp - core >= outlier_widening) {
+            axis.exp = core;
+            lo = values[k];
+            hi = values[values.size() - 1 - k];
+        }
+        axis.offset = axis.globalBin(lo, axis.exp);
+        axis.low = lo;
+        axis.high = hi;
+    }
+    m_bins.assign(m_axes[0].nbins * m_axes[1].nbins, 0);
+    auto buffer = std::move(m_buffer);
+    m_buffer.clear();
+    for (std::size_t p = 0; p < buffer.size(); p += stride) {
+        insert(&buffer[p], buffer[p + m_dims]);
+    }
+}
+
+void AutoHistogram::widen(int axis, int exp, double lo) {
+    rebin(axis, exp, m_axes[axis].globalBin(lo, exp));
+}
+
+void AutoHistogram::rebin(int axis, int exp, long long offset) {
+    Axis& ax = m_axes[axis];
+    std::vector<double> bins(m_bins.size());
+    for (int iy = 0; iy < m_axes[1].nbins; ++iy) {
+        for (int ix = 0; ix < m_axes[0].nbins; ++ix) {
+            const double content = m_bins[cell(ix, iy)];
+            if (content == 0) {
+                continue;
+            }
+            int index[2] = {ix, iy};
+            index[axis] = floorShift(ax.offset + index[axis], exp - ax.exp) - offset;
+            bins[cell(index[0], index[1])] += content;
+        }
+    }
+    m_bins = std::move(bins);
+    ax.exp = exp;
+    ax.offset = offset;
+}
+
+std::size_t AutoHistogram::cell(int ix, int iy) const {
+    return ix + static_cast<std::size_t>(m_axes[0].nbins) * iy;
+}
+
+int AutoHistogram::displayBin(int axis, int i, const TAxis* display) const {
+    // Splitting a fine bin by overlap would put weight where no value was filled
+    const auto [lo, hi] = m_axes[axis].edges(i);
+    return display->FindFixBin(lo + (hi - lo) / 2);
+}
@@ -9,6 +9,7 @@
 #include <csignal>
 #include <algorithm>
 #include <array>
+#include <numeric>
 #include <string>
 #include <unistd.h>
 #include <unordered_map>
@@ -18,7 +19,6 @@
 #include "Console.h"
 #include "RtypesCore.h"
 #include "TTree.h"
-#include "TTreeFormula.h"
 #include "TH1.h"
 #include "TH2.h"
 
@@ -28,6 +28,7 @@
 #include "nlohmann/json.hpp"
 
 volatile bool resize_flag = false;
+extern int resize_fd[2];
 
 FileBrowser::FileBrowser() {
     initNcurses();
@@ -35,6 +36,8 @@ FileBrowser::FileBrowser() {
     loadSettings();
     console.loadCommandHistory(dotpath / "tbhistory");
     initAllWindows();
+    draw_engine.setColumnCache(&column_cache);
+    draw_engine.setSelectionCache(&selection_cache);
 
     refresh();
     box(dir_window, 0, 0);
@@ -56,6 +59,7 @@ void FileBrowser::initAllWindows() {
 }
 
 FileBrowser::~FileBrowser() {
+    cancelDraw();
     saveSettings();
     delwin(cmd_window);
     delwin(main_window);
@@ -71,6 +75,7 @@ void FileBrowser::initNcurses() {
     cbreak();
     keypad(stdscr, TRUE);
     curs_set(0);
+    set_escdelay(25); // ESC cancels draws, don't wait for escape sequences
 
     mouseinterval(0);
     mousemask(ALL_MOUSE_EVENTS | REPORT_MOUSE_POSITION, NULL);
@@ -129,9 +134,44 @@ void FileBrowser::loadSettings() {
         if (settings_json.contains("statsbox")) {
             showstats = settings_json["statsbox"];
         }
+        if (settings_json.contains("robust_range") && settings_json["robust_range"].is_boolean()) {
+            robust_range = settings_json["robust_range"];
+        }
         if (settings_json.contains("menu_width") && settings_json["menu_width"].is_number()) {
             menu_width = settings_json["menu_width"];
         }
+        if (settings_json.contains("draw_buffer") && settings_json["draw_buffer"].is_number_unsigned()) {
+            // Values kept per histogram while its range is unknown
+            draw_engine.setBufferSize(settings_json["draw_buffer"]);
+        }
+        if (settings_json.contains("hist_cache_mb") && settings_json["hist_cache_mb"].is_number_unsigned()) {
+            // Memory for filled histograms of previous draws
+            histogram_cache.setBudget(settings_json["hist_cache_mb"].get<std::size_t>() << 20);
+        }
+        if (settings_json.contains("column_cache_mb") && settings_json["column_cache_mb"].is_number_unsigned()) {
+            // Memory for values of leaves read by previous draws
+            column_cache.setBudget(settings_json["column_cache_mb"].get<std::size_t>() << 20);
+        }
+        if (settings_json.contains("selection_cache_mb") && settings_json["selection_cache_mb"].is_number_unsigned()) {
+            // Memory for entries passing the selections of previous draws
+            selection_cache.setBudget(settings_json["selection_cache_mb"].get<std::size_t>() << 20);
+        }
+        if (settings_json.contains("compiled_kernels") && settings_json["compiled_kernels"].is_boolean()) {
+            // Opt-in, compiling an expression takes a moment on first use
+            draw_engine.setKernelCompiler(settings_json["compiled_kernels"] ? &kernel_compiler : nullptr);
+        }
+        if (settings_json.contains("threads") && settings_json["threads"].is_number_unsigned()) {
+            // Threads filling histograms, 0 for all cores
+            draw_engine.setThreads(settings_json["threads"]);
+        }
+        if (settings_json.contains("prefetch") && settings_json["prefetch"].is_boolean()) {
+            // Fill the highlighted leaf while the menu rests on it
+            prefetch = settings_json["prefetch"];
+        }
+        if (settings_json.contains("sample_fraction") && settings_json["sample_fraction"].is_number()) {
+            // Clusters read for the preview of large trees
+            sample_fraction = std::clamp<double>(settings_json["sample_fraction"], 1e-6, 1.0);
+        }
     }
 }
 
@@ -144,6 +184,7 @@ void FileBrowser::saveSettings() {
             case 4: settings_json["blockmode"] = "4x2"; break;
         }
         settings_json["statsbox"] = showstats;
+        settings_json["robust_range"] = robust_range;
         settings_json["menu_width"] = menu_width;
         saveSettings << settings_json;
         saveSettings.close();
@@ -154,47 +195,102 @@ void FileBrowser::loadFile(std::string filename) {
     mvwprintw(dir_window, 0, 1, "Reading...");
     wrefresh(dir_window);
 
-    root_file.load(filename);
+    root_file.load(filename, dotpath / "index", [](){
+        // Wake up main loop, called from indexing thread
+        write(resize_fd[1], &notify_index, 1);
+    });
     console.setTabCompletionDict(root_file.displayList);
     object_menu.setMenuExtent(root_file.menuLength(false), getmaxy(dir_window) - 2);
 }
 
+void FileBrowser::handleIndexUpdate() {
+    if (root_file.mergeIndexed()) {
+        console.setTabCompletionDict(root_file.displayList);
+        object_menu.setMenuExtent(root_file.menuLength(searchMode.isActive), getmaxy(dir_window) - 2);
+    }
+}
+
+bool FileBrowser::hasIdleWork() {
+    return prefetch_state.pending || root_file.hasUnreadTrees();
+}
+
+void FileBrowser::handleIdle() {
+    if (prefetch_state.pending && std::chrono::steady_clock::now() >= prefetch_state.due) {
+        // Selection rested on a leaf, fill it unless a draw runs or it is cached
+        prefetch_state.pending = false;
+        const RootFile::Node& leaf = prefetch_state.leaf;
+        if (draw_job == nullptr) {
+            TTree* tree = root_file.m_trees.at(root_file.treeIndex(leaf)).get();
+            const char* leafname = root_file.m_leaves.at(leaf.index())->GetName();
+            const auto key = drawKey(tree, leafname, "", {}, TVirtualTreePlayer::kMaxEntries, 0);
+            if (histogram_cache.find(key) == nullptr) {
+                startDraw(tree, key, true);
+            }
+        }
+        return;
+    }
+    // Leaves of unopened trees for tab completion
+    if (root_file.readNextTree()) {
+        console.setTabCompletionDict(root_file.displayList);
+        if (searchMode.isActive) {
+            // Matching leaves of the read tree are listed
+            object_menu.setMenuExtent(root_file.menuLength(true), getmaxy(dir_window) - 2);
+        }
+        else {
+            skipDraw = true; // Read trees stay closed
+        }
+    }
+}
+
 void FileBrowser::printDirectories() {
     if (skipDraw) { skipDraw = false; return; }
     const int x = getbegx(dir_window) + 1;
     const int y = getbegy(dir_window) + 1;
     const int maxlines = object_menu.getMenuLines();
 
+    const int unread = root_file.unreadTrees();
     if (searchMode.isActive) {
         attron(A_BOLD | A_ITALIC);
         mvprintw(0, 0, "/%s", searchMode.input.c_str());
         attroff(A_BOLD | A_ITALIC);
+        if (unread > 0) {
+            // Results grow while the idle loop reads the remaining trees
+            printw("  (%d trees left to search)", unread);
+        }
         clrtoeol();
     }
 
     // No results message
     if (object_menu.getMenuObjects() == 0) {
-        mvwprintw(dir_window, y, x, "No results for \"%s\"", searchMode.input.c_str());
+        mvwprintw(dir_window, y, x, unread > 0 ? "No results for \"%s\" yet" : "No results for \"%s\"",
+                  searchMode.input.c_str());
         wclrtoeol(dir_window);
     }
     else {
         wclear(dir_window);
     }
 
-    auto print_entry = [this, y, x](std::string name, RootFile::Node* node, int entry){
+    auto print_entry = [this, y, x](std::string_view menuName, RootFile::Node node, int entry){
         std::string entry_label;
-        const int nesting = searchMode.isActive ? 0 : node->nesting;
-        name = std::string(nesting, ' ') + name;
+        const int nesting = searchMode.isActive ? 0 : node.nesting();
+        const std::string name = std::string(nesting, ' ') + std::string(menuName);
         TermColor col = col_white;
         int attr = A_NORMAL;
-        switch (node->type) {
+        switch (node.type()) {
             case NodeType::DIRECTORY:
-                if (node->openState & RootFile::Node::DIR_OPEN) 
+                if (node.isOpen()) 
                     { entry_label = fmtstring("{} {}", SYMB_FOLDER_OPEN, name); }
                 else
                     { entry_label = fmtstring("{} {}", SYMB_FOLDER_CLOSED, name); }
                 col = col_yellow;
                 break;
+            case NodeType::BRANCH:
+                if (node.isOpen())
+                    { entry_label = fmtstring("{} {}", SYMB_BRANCH_OPEN, name); }
+                else
+                    { entry_label = fmtstring("{} {}", SYMB_BRANCH_CLOSED, name); }
+                col = col_green;
+                break;
             case NodeType::TLEAF:   entry_label = fmtstring("{} {}", SYMB_TLEAF, name); break;
             case NodeType::TTREE:   entry_label = fmtstring("{} {}", SYMB_TTREE, name); col = col_green; attr = A_BOLD; break;
             case NodeType::HIST:    entry_label = fmtstring("{} {}", SYMB_THIST, name); col = col_blue; attr = A_ITALIC; break;
@@ -221,20 +317,44 @@ void FileBrowser::printDirectories() {
         attroff(attr | COLOR_PAIR(col));
     };
 
-    auto print_object_name = [this](RootFile::Node* node){
+    auto print_object_name = [this](RootFile::Node node){
         auto descr = root_file.toString(node);
         mvprintw(getmaxy(stdscr) - 1, 0, "%s", descr.c_str());
         if (root_file.m_trees.size() > 1) {
             // Also show corresponding tree
-            if (node->type == NodeType::TLEAF) {
-                const RootFile::Node* mother = node->mother;
-                if (mother->type == NodeType::TTREE) {
+            if (node.type() == NodeType::TLEAF || node.type() == NodeType::BRANCH) {
+                const int tree = root_file.treeIndex(node);
+                if (tree >= 0) {
                     attron(COLOR_PAIR(TermColor::col_green));
-                    printw(" TTree=%s", root_file.m_trees.at(mother->index)->GetName());
+                    printw(" TTree=%s", root_file.m_trees.at(tree).name());
                     attroff(COLOR_PAIR(TermColor::col_green));
                 }
             }
         }
+        if (const int tree = root_file.treeIndex(node); node.type() == NodeType::TLEAF && tree >= 0
+            && root_file.m_trees.at(tree).isLoaded()) {
+            // Statistics once the tree was described
+            const auto found = tree_summaries.find(root_file.m_trees.at(tree).get());
+            TLeaf* tleaf = found != tree_summaries.end() ? root_file.m_leaves.at(node.index()).get() : nullptr;
+            if (tleaf != nullptr) {
+                // Leaf names repeat across branches, summaries are matched by the full name
+                const std::string leafname = tleaf->GetFullName();
+                for (const auto& leaf : found->second) {
+                    if (leaf.name != leafname) {
+                        continue;
+                    }
+                    if (!leaf.summarized) {
+                        printw(" | not summarized");
+                    }
+                    else {
+                        printw(" | %s", fmtstring("n={} [{:.4g}, {:.4g}] mean={:.4g} rms={:.4g} nan/inf={} zero={:.1f}%",
+                                                  leaf.entries, leaf.min, leaf.max, leaf.mean, leaf.rms(),
+                                                  leaf.nonfinite, 100 * leaf.zeroFraction()).c_str());
+                    }
+                    break;
+                }
+            }
+        }
         clrtoeol();
     };
     for (int i = 0; i < maxlines; ++i) {
@@ -242,7 +362,7 @@ void FileBrowser::printDirectories() {
         auto MenuEntry = root_file.getEntry(nentry, searchMode.isActive);
         if (MenuEntry.has_value()) {
             const auto& [name, node] = *MenuEntry;
-            const bool showCondition = searchMode.isActive ? node->showInSearch : (node->openState & RootFile::Node::LISTED) != 0;
+            const bool showCondition = searchMode.isActive ? node.showInSearch() : node.isListed();
 
             if (showCondition) {
                 print_entry(name, node, i);
@@ -257,6 +377,12 @@ void FileBrowser::printDirectories() {
     }
 
     box(dir_window, 0, 0);
+    if (root_file.isIndexing()) {
+        auto [indexed, found] = root_file.indexProgress();
+        wattron(dir_window, A_ITALIC);
+        mvwprintw(dir_window, 0, 1, "Indexing %i/%i", indexed, found);
+        wattroff(dir_window, A_ITALIC);
+    }
     if (searchMode.isActive) {
         attron(A_BOLD | A_REVERSE);
         mvprintw(y - 1, x, "[SEARCH MODE]");
@@ -276,6 +402,23 @@ void FileBrowser::toggleStatsBox() {
     showstats = !showstats; 
 } 
 
+void FileBrowser::toggleSampleOnly() {
+    sample_only = !sample_only;
+}
+
+void FileBrowser::toggleRobustRange() {
+    robust_range = !robust_range;
+}
+
+void FileBrowser::cycleSummaryColumn() {
+    summary_view.column = (summary_view.column + 1) % 8;
+    summary_view.descending = summary_view.column != 0; // Largest values first
+}
+
+void FileBrowser::reverseSummaryOrder() {
+    summary_view.descending = !summary_view.descending;
+}
+
 void FileBrowser::toggleLogy() {
     logscale = !logscale; 
 } 
@@ -305,18 +448,16 @@ TTree* FileBrowser::getActiveTTree() {
 
     if (menuEntry.has_value()) {
         auto [name, node] = *menuEntry;
-        if (node->type == NodeType::TLEAF) {
-            ttree = root_file.m_trees[node->mother->index];
-        }
-        else if (node->type == NodeType::TTREE) {
-            ttree = root_file.m_trees[node->index];
+        const int tree = root_file.treeIndex(node);
+        if (tree >= 0) {
+            ttree = root_file.m_trees[tree].get();
         }
     }
 
     if (ttree == nullptr) {
         // No tree selected, return obvious single choice
         if (root_file.m_trees.size() == 1) {
-            ttree = root_file.m_trees[0];
+            ttree = root_file.m_trees[0].get();
         }
         else {
             console.setError("No TTree found in file!");
@@ -329,7 +470,10 @@ TTree* FileBrowser::getActiveTTree() {
 
 void FileBrowser::plotHistogram() {
     if (console.hasCommand()) {
-        if (std::get<0>(console.current_args).hist2d) {
+        if (std::get<0>(console.current_args).multiple) {
+            plotHistograms(console.current_args);
+        }
+        else if (std::get<0>(console.current_args).hist2d) {
             plot2DHistogram(console.current_args);
         }
         else {
@@ -340,9 +484,9 @@ void FileBrowser::plotHistogram() {
         auto Entry = root_file.getEntry(object_menu.getSelectedEntryIndex());
         if (Entry.has_value()) {
             const auto& [name, node] = *Entry;
-            if (node->type == NodeType::TLEAF) {
-                plotHistogram(root_file.m_trees.at(node->mother->index), 
-                              root_file.m_leaves.at(node->index));
+            if (node.type() == NodeType::TLEAF) {
+                plotHistogram(root_file.m_trees.at(root_file.treeIndex(node)).get(), 
+                              root_file.m_leaves.at(node.index()).get());
             }
         }
     }
@@ -353,41 +497,317 @@ bool FileBrowser::isRunning() const {
 }
 
 void FileBrowser::plotHistogram(TTree* tree, TLeaf* leaf) {
-    // Get window position and size
-    const int winx = getbegx(main_window);
-    const int winy = getbegy(main_window);
-    getmaxyx(main_window, mainwin_y, mainwin_x);
-    box(main_window, 0, 0);
-
     const char* leafname = leaf->GetName();
-    std::string leafname_str(leafname);
+    const AutoHistogram* filled = getHistogram(leafname, tree, leafname, "", {}, TVirtualTreePlayer::kMaxEntries, 0);
+    if (filled != nullptr) {
+        plotFilledHistogram(*filled, leafname, {});
+    }
+}
 
-    mvprintw(winy + mainwin_y / 2, winx + mainwin_x / 2 - 5 - leafname_str.size() * 0.5, "Reading %s...", leafname);
-    refresh();
+const AutoHistogram* FileBrowser::getHistogram(const std::string& title, TTree* tree, const std::string& varexp,
+                                               const std::string& selection, const std::vector<double>& limits,
+                                               Long64_t nentries, Long64_t firstentry) {
+    const auto filled = getHistograms(title, tree, {varexp}, selection, limits, nentries, firstentry);
+    return filled.empty() ? nullptr : filled.front();
+}
 
-    // Get bounds
-    auto bins_x = getBinsx();
-    auto bins_y = getBinsy();
-    auto min = tree->GetMinimum(leafname);
-    auto max = tree->GetMaximum(leafname);
-    AxisTicks xaxis(min, max);
+std::vector<const AutoHistogram*> FileBrowser::getHistograms(const std::string& title, TTree* tree,
+                                                             const std::vector<std::string>& varexps,
+                                                             const std::string& selection,
+                                                             const std::vector<double>& limits,
+                                                             Long64_t nentries, Long64_t firstentry) {
+    // Display options only change the rendering, the fill is reused
+    std::string varexp;
+    for (const auto& part : varexps) {
+        varexp += (varexp.empty() ? "" : ";") + part;
+    }
+    const HistogramCache::Key key = drawKey(tree, varexp, selection, limits, nentries, firstentry);
+    last_plot.title = title;
+    summary_view.tree = nullptr;
+    if (key.sample < 1.0) {
+        last_plot.title += fmtstring(" [{:g}% sample]", 100 * sample_fraction);
+    }
+    last_plot.key = key;
+
+    auto showReading = [this, &varexp]() {
+        const int winx = getbegx(main_window);
+        const int winy = getbegy(main_window);
+        getmaxyx(main_window, mainwin_y, mainwin_x);
+        box(main_window, 0, 0);
+        mvprintw(winy + mainwin_y / 2, winx + mainwin_x / 2 - 5 - varexp.size() * 0.5, "Reading %s...", varexp.c_str());
+        refresh();
+    };
+    if (draw_job != nullptr) {
+        if (draw_job->key == key) {
+            if (draw_job->speculative) {
+                // Prefetched, continue from what was read so far
+                draw_job->speculative = false;
+                showReading();
+                handleDrawUpdate();
+            }
+            return {}; // Still reading, plotted when done
+        }
+        cancelDraw();
+    }
+    // Each expression is cached on its own, also when drawn together
+    std::vector<const AutoHistogram*> cached;
+    for (const auto& part : varexps) {
+        HistogramCache::Key single = key;
+        single.varexp = part;
+        if (const auto filled = histogram_cache.find(single); filled != nullptr) {
+            cached.push_back(filled.get());
+        }
+    }
+    if (cached.size() == varexps.size()) {
+        return cached;
+    }
 
-    TH1D hist("H", leafname, bins_x, xaxis.minAdjusted(), xaxis.maxAdjusted());
+    showReading();
+    startDraw(tree, key);
+    return {};
+}
 
-    tree->Project("H", leafname);
+HistogramCache::Key FileBrowser::drawKey(TTree* tree, const std::string& varexp, const std::string& selection,
+                                         const std::vector<double>& limits, Long64_t nentries, Long64_t firstentry) const {
+    HistogramCache::Key key{tree, varexp, selection, limits, nentries, firstentry, draw_engine.bufferSize()};
+    if (sample_only && tree->GetEntries() >= preview_min_entries) {
+        key.sample = sample_fraction;
+    }
+    return key;
+}
 
-    if (hist.GetEntries() == 0) {
-        showEmpty();
+void FileBrowser::startDraw(TTree* tree, const HistogramCache::Key& key, bool speculative) {
+    cancelDraw();
+    draw_job = std::make_unique<DrawJob>();
+    draw_job->key = key;
+    draw_job->speculative = speculative;
+
+    DrawJob* job = draw_job.get();
+    // A prefetch runs on few threads, at normal priority since a request of
+    // the same draw takes it over
+    DrawEngine engine = draw_engine;
+    if (speculative) {
+        engine.setThreads(prefetch_threads);
+    }
+    auto publish = [job](const std::vector<AutoHistogram>& partial, Long64_t processed, Long64_t total) {
+        {
+            std::lock_guard lock(job->mutex);
+            job->partial = partial;
+            job->processed = processed;
+            job->total = total;
+        }
+        write(resize_fd[1], &notify_draw, 1);
+    };
+    job->worker = std::jthread([this, job, tree, publish, engine](std::stop_token stop) {
+        const auto& args = job->key;
+        try {
+            // Own file handle, the menu keeps reading the shared one meanwhile
+            std::unique_ptr<TFile> file;
+            TTree* copy = nullptr;
+            {
+                std::lock_guard lock(root_io_mutex);
+                copy = DrawEngine::openCopy(tree, file);
+            }
+            // Otherwise the shared tree is read, locked one cluster at a time
+            std::recursive_mutex* io = nullptr;
+            if (copy == nullptr) {
+                copy = tree;
+                io = &root_io_mutex;
+            }
+
+            const auto varexps = Console::FirstDrawArg::split(args.varexp);
+            std::vector<AutoHistogram> hists;
+            if (args.sample < 1.0) {
+                hists = engine.sample(copy, varexps, args.selection, args.limits, args.nentries,
+                                           args.firstentry, args.sample, stop, publish, io);
+            }
+            else {
+                // Entries the draw will read, like DrawEngine::draw limits them
+                const Long64_t entries = copy->GetEntries();
+                const Long64_t last = std::min(entries, args.firstentry + std::min(args.nentries, entries));
+                const Long64_t total = std::max<Long64_t>(0, last - args.firstentry);
+                if (total >= preview_min_entries) {
+                    // Shape from a few clusters first, then the exact result
+                    publish(engine.sample(copy, varexps, args.selection, args.limits, args.nentries,
+                                               args.firstentry, sample_fraction, stop, {}, io),
+                            0, total);
+                }
+                hists = engine.draw(copy, varexps, args.selection, args.limits, args.nentries, args.firstentry,
+                                         stop, publish, io);
+            }
+            std::lock_guard lock(job->mutex);
+            job->result = std::move(hists);
+        }
+        catch (std::runtime_error& error) {
+            std::lock_guard lock(job->mutex);
+            job->error = error.what();
+        }
+        catch (...) {
+            // Anything escaping the thread would terminate the browser
+            std::lock_guard lock(job->mutex);
+            job->error = "Draw failed";
+        }
+        {
+            std::lock_guard lock(job->mutex);
+            job->finished = true;
+        }
+        write(resize_fd[1], &notify_draw, 1);
+    });
+}
+
+void FileBrowser::cancelDraw() {
+    // Stops at the next cluster
+    if (draw_job != nullptr) {
+        draw_job->worker.request_stop();
+        draw_job->worker.join();
+        draw_job.reset();
+    }
+}
+
+void FileBrowser::describeTree() {
+    TTree* tree = getActiveTTree();
+    if (tree == nullptr) {
+        return;
+    }
+    if (tree_summaries.contains(tree)) {
+        summary_view.tree = tree;
+        plotSummary();
+        return;
+    }
+    cancelDraw();
+    draw_job = std::make_unique<DrawJob>();
+    draw_job->key.tree = tree;
+    draw_job->describe = true;
+
+    clearAxisArea();
+    werase(main_window);
+    box(main_window, 0, 0);
+    mvwprintw(main_window, mainwin_y / 2, std::max(1, mainwin_x / 2 - 10), "Describing %s...", tree->GetName());
+    wrefresh(main_window);
+
+    DrawJob* job = draw_job.get();
+    job->worker = std::jthread([this, job, tree](std::stop_token stop) {
+        try {
+            // Own file handle like a draw, threads open further ones
+            std::unique_ptr<TFile> file;
+            TTree* copy = nullptr;
+            {
+                std::lock_guard lock(root_io_mutex);
+                copy = DrawEngine::openCopy(tree, file);
+            }
+            std::recursive_mutex* io = nullptr;
+            if (copy == nullptr) {
+                copy = tree;
+                io = &root_io_mutex;
+            }
+            auto summary = draw_engine.describe(copy, stop, [job](Long64_t processed, Long64_t total) {
+                {
+                    std::lock_guard lock(job->mutex);
+                    job->processed = processed;
+                    job->total = total;
+                }
+                write(resize_fd[1], &notify_draw, 1);
+            }, io);
+            std::lock_guard lock(job->mutex);
+            job->summary = std::move(summary);
+        }
+        catch (std::runtime_error& error) {
+            std::lock_guard lock(job->mutex);
+            job->error = error.what();
+        }
+        catch (...) {
+            std::lock_guard lock(job->mutex);
+            job->error = "Describe failed";
+        }
+        {
+            std::lock_guard lock(job->mutex);
+            job->finished = true;
+        }
+        write(resize_fd[1], &notify_draw, 1);
+    });
+}
+
+void FileBrowser::handleDrawUpdate() {
+    if (draw_job == nullptr) {
+        return; // Notification of a cancelled draw
+    }
+    std::unique_lock lock(draw_job->mutex);
+    if (!draw_job->finished) {
+        if (draw_job->speculative) {
+            return; // Partial result is kept until the leaf is selected
+        }
+        if (draw_job->describe) {
+            const Long64_t processed = draw_job->processed;
+            const Long64_t total = draw_job->total;
+            lock.unlock();
+            plotProgressBar(processed, total);
+            return;
+        }
+        if (draw_job->partial.has_value()) {
+            const std::vector<AutoHistogram> partial = std::move(*draw_job->partial);
+            draw_job->partial.reset();
+            const Long64_t processed = draw_job->processed;
+            const Long64_t total = draw_job->total;
+            lock.unlock();
+            plotProgress(partial, processed, total);
+        }
+        return;
+    }
+    lock.unlock();
+
+    draw_job->worker.join();
+    const auto job = std::move(draw_job);
+    if (job->summary.has_value()) {
+        tree_summaries[job->key.tree] = std::move(*job->summary);
+        summary_view.tree = job->key.tree;
+        plotSummary();
+    }
+    else if (job->result.has_value()) {
+        const auto varexps = Console::FirstDrawArg::split(job->key.varexp);
+        for (std::size_t i = 0; i < varexps.size(); ++i) {
+            HistogramCache::Key key = job->key;
+            key.varexp = varexps[i];
+            histogram_cache.insert(key, std::move((*job->result)[i]));
+        }
+        if (!job->speculative) {
+            replot();
+        }
+    }
+    else if (!job->speculative) {
+        console.setError(job->error.c_str());
+        refreshCMDWindow();
+    }
+}
+
+void FileBrowser::plotProgress(const std::vector<AutoHistogram>& partial, Long64_t processed, Long64_t total) {
+    // Shape of a running draw, redrawn from the entries read so far
+    if (partial.size() > 1) {
+        std::vector<const AutoHistogram*> panels;
+        for (const auto& hist : partial) {
+            panels.push_back(&hist);
+        }
+        plotGrid(panels, Console::FirstDrawArg::split(last_plot.key.varexp), last_plot.title);
+    }
+    else if (partial.front().dimension() == 2) {
+        plotFilledHistogram2D(partial.front(), last_plot.title, last_plot.key.limits);
     }
     else {
-        AxisTicks yaxis(0, hist.GetAt(hist.GetMaximumBin())*top_hist_clear, 5, logscale);
+        plotFilledHistogram(partial.front(), last_plot.title, last_plot.key.limits);
+    }
 
-        plotYAxis(yaxis, true);
-        plotXAxis(xaxis, false);
-        plotASCIIHistogram(&hist, bins_y, bins_x, yaxis.min(), yaxis.max());
-        plotCanvasAnnotations(&hist);
+    plotProgressBar(processed, total);
+}
+
+void FileBrowser::plotProgressBar(Long64_t processed, Long64_t total) {
+    const double fraction = total > 0 ? static_cast<double>(processed) / total : 1.0;
+    const std::string counter = fmtstring(" {:3.0f}% {}/{} entries ", 100 * fraction, processed, total);
+    const int width = std::min(40, mainwin_x - 6 - static_cast<int>(counter.size()));
+    std::string bar;
+    for (int i = 0; i < width; ++i) {
+        bar += i < fraction * width ? "█" : "░";
     }
-    refresh();
+    mvwprintw(main_window, mainwin_y - 1, 2, "┤%s%s├", bar.c_str(), counter.c_str());
+    wrefresh(main_window);
 }
 
 void FileBrowser::showEmpty() {
@@ -401,15 +821,6 @@ void FileBrowser::showEmpty() {
 }
 
 void FileBrowser::plotHistogram(const Console::DrawArgs& args) {
-    // Get window position and size
-    const int winx = getbegx(main_window);
-    const int winy = getbegy(main_window);
-    getmaxyx(main_window, mainwin_y, mainwin_x);
-    box(main_window, 0, 0);
-
-    mvprintw(winy + mainwin_y / 2, winx + mainwin_x / 2 - 5, "Reading...");
-    refresh();
-
     const auto& [varexp, selection, option, nentries, firstentry] = args;
 
     // Get selected tree
@@ -418,107 +829,129 @@ void FileBrowser::plotHistogram(const Console::DrawArgs& args) {
         return;
     }
 
-    // Get bounds
-    auto bins_x = getBinsx();
-    auto bins_y = getBinsy();
-
-    ttree->SetEstimate(ttree->GetEntries());
-    Long64_t entriesDrawn = -1;
-    try {
-        entriesDrawn = ttree->Draw(varexp.expression.c_str(), selection.c_str(), option, nentries, firstentry);
+    std::string title;
+    if (selection.empty()) {
+        title = varexp.expression;
+    }
+    else {
+        title = fmtstring("{} ({})", varexp.expression, selection);
     }
-    catch (...) {
-        console.setError("TTreeFormula Error");
+
+    const AutoHistogram* filled = getHistogram(title, ttree, varexp.expression, selection, varexp.limits, nentries, firstentry);
+    if (filled == nullptr) {
         return;
     }
+    plotFilledHistogram(*filled, title, varexp.limits);
+}
 
-    auto vector_branches = [ttree] (const char* form) -> TLeaf* {
-        // Check if formula involves vector branches
-        TTreeFormula formula("FORM", form, ttree);
-        for (int v = 0; v < formula.GetNdim(); ++v) {
-            if (TLeaf* leaf = formula.GetLeaf(v)->GetLeafCount(); leaf != nullptr) {
-                formula.Delete();
-                return leaf;
+void FileBrowser::replot() {
+    if (summary_view.tree != nullptr) {
+        plotSummary();
+        return;
+    }
+    // Render the last plot again from its fine histogram, e.g. at a new size
+    if (const auto varexps = Console::FirstDrawArg::split(last_plot.key.varexp); varexps.size() > 1) {
+        std::vector<const AutoHistogram*> panels;
+        for (const auto& varexp : varexps) {
+            HistogramCache::Key key = last_plot.key;
+            key.varexp = varexp;
+            if (const auto filled = histogram_cache.find(key); filled != nullptr) {
+                panels.push_back(filled.get());
             }
         }
-        formula.Delete();
-        return nullptr;
-    };
-
-    if (TLeaf* lenLeaf = vector_branches(varexp.expression.c_str()); lenLeaf != nullptr && false) {
-        // AFAIK, an efficient loop is required now
-        // SKIP!
-        TTreeFormula formula("FORM", varexp.expression.c_str(), ttree);
-        auto nEntriesTop = ttree->GetEntries();
-        Long64_t len = 0;
-        ttree->SetBranchStatus(lenLeaf->GetName(), true);
-        ttree->SetBranchAddress(lenLeaf->GetName(), &len);
-        for (int i = 0; i < nEntriesTop; ++i) {
-            ttree->GetEntry(i);
-
+        if (panels.size() == varexps.size() && !plotting) {
+            plotGrid(panels, varexps, last_plot.title);
         }
+        return;
+    }
+    const auto filled = histogram_cache.find(last_plot.key);
+    if (filled == nullptr || plotting) {
+        return;
     }
-    else if (entriesDrawn != -1) {
-        Double_t* data = ttree->GetV1();
-        // This is a hack
-        Long64_t n = std::min<Long64_t>(ttree->GetSelectedRows(), ttree->GetEntries());
-        Double_t min = *std::min_element(data, data + n);
-        Double_t max = *std::max_element(data, data + n);
+    if (filled->dimension() == 2) {
+        plotFilledHistogram2D(*filled, last_plot.title, last_plot.key.limits);
+    }
+    else {
+        plotFilledHistogram(*filled, last_plot.title, last_plot.key.limits);
+    }
+}
 
-        std::string title;
-        if (selection.empty()) {
-            title = varexp.expression;
-        }
-        else {
-            title = fmtstring("{} ({})", varexp.expression, selection);
-        }
-
-        TH1D hist;
-        AxisTicks xaxis;
-        if (!varexp.limits.empty()) {
-            min = varexp.limits.at(0);
-            max = varexp.limits.at(1);
-            xaxis = AxisTicks(min, max, 10);
-            hist = TH1D("TEMP", title.c_str(), bins_x, min, max);
-            for (int i = 0; i < n; ++i) {
-                if (data[i] >= min && data[i] <= max) {
-                    hist.Fill(data[i]);
-                }
-            }
-            hist.Draw("goff");
-        }
-        else {
-            xaxis = AxisTicks(min, max, 10);
-            hist = TH1D("TEMP", title.c_str(), bins_x, xaxis.minAdjusted(), xaxis.maxAdjusted());
-            hist.FillN(n, data, nullptr);
-            hist.Draw("goff");
+std::pair<double, double> FileBrowser::plotRange(const AutoHistogram& filled, int axis) const {
+    if (robust_range) {
+        // A few extreme values, e.g. sentinels, end up in the overflow
+        const double min = filled.quantile(robust_quantile, axis);
+        const double max = filled.quantile(1 - robust_quantile, axis);
+        if (min < max) {
+            return {min, max};
         }
+    }
+    return {filled.min(axis), filled.max(axis)};
+}
+
+void FileBrowser::plotFilledHistogram(const AutoHistogram& filled, const std::string& title, const std::vector<double>& limits) {
+    // Axis space changes resize the window, which must not replot meanwhile
+    const PlottingScope scope(plotting);
+    getmaxyx(main_window, mainwin_y, mainwin_x);
+    box(main_window, 0, 0);
+    if (filled.empty()) {
+        showEmpty();
+        refresh();
+        return;
+    }
 
-        AxisTicks yaxis(0, hist.GetAt(hist.GetMaximumBin())*top_hist_clear, 5, logscale);
+    // Get bounds
+    auto bins_x = getBinsx();
+    auto bins_y = getBinsy();
 
-        plotYAxis(yaxis, true);
-        plotXAxis(xaxis, !varexp.limits.empty());
-        plotASCIIHistogram(&hist, bins_y, bins_x, yaxis.min(), yaxis.max());
-        plotCanvasAnnotations(&hist);
+    // Display bins are whole fine bins, the axis is labelled over that range
+    std::pair<double, double> range;
+    if (!limits.empty()) {
+        range = filled.alignedRange(0, limits.at(0), limits.at(1), bins_x);
     }
     else {
-        console.setError("Branch not found");
+        const auto [min, max] = plotRange(filled, 0);
+        const AxisTicks ticks(min, max, 10);
+        range = filled.alignedRange(0, ticks.minAdjusted(), ticks.maxAdjusted(), bins_x);
     }
+    AxisTicks xaxis(range.first, range.second, 10);
+    TH1D hist("TEMP", title.c_str(), bins_x, range.first, range.second);
+    filled.project(hist);
+
+    AxisTicks yaxis(0, hist.GetAt(hist.GetMaximumBin())*top_hist_clear, 5, logscale);
+
+    plotYAxis(yaxis, true);
+    plotXAxis(xaxis, true);
+    plotASCIIHistogram(&hist, bins_y, bins_x, yaxis.min(), yaxis.max());
+    plotCanvasAnnotations(&hist, filled);
 
     refresh();
 }
 
 void FileBrowser::plot2DHistogram(const Console::DrawArgs& args) {
     // The console has already checked whether the format is correct for 2D drawing
-    // Get window position and size
-    const int winx = getbegx(main_window);
-    const int winy = getbegy(main_window);
-    getmaxyx(main_window, mainwin_y, mainwin_x);
-    box(main_window, 0, 0);
+    const auto& [varexp, selection, option, nentries, firstentry] = args;
 
-    mvprintw(winy + mainwin_y / 2, winx + mainwin_x / 2 - 5, "Reading...");
-    refresh();
+    TTree* ttree = getActiveTTree();
+    if (ttree == nullptr) {
+        return;
+    }
+
+    std::string title;
+    if (selection.empty()) {
+        title = varexp.expression;
+    }
+    else {
+        title = fmtstring("{} ({})", varexp.expression, selection);
+    }
 
+    const AutoHistogram* filled = getHistogram(title, ttree, varexp.expression, selection, varexp.limits, nentries, firstentry);
+    if (filled == nullptr) {
+        return;
+    }
+    plotFilledHistogram2D(*filled, title, varexp.limits);
+}
+
+void FileBrowser::plotHistograms(const Console::DrawArgs& args) {
     const auto& [varexp, selection, option, nentries, firstentry] = args;
 
     TTree* ttree = getActiveTTree();
@@ -526,96 +959,281 @@ void FileBrowser::plot2DHistogram(const Console::DrawArgs& args) {
         return;
     }
 
-    // Get bounds
-    auto bins_x = mainwin_x - 2;
-    auto bins_y = mainwin_y - 2;
+    const auto varexps = Console::FirstDrawArg::split(varexp.expression);
+    std::string title;
+    for (const auto& part : varexps) {
+        title += (title.empty() ? "" : "; ") + part;
+    }
+    if (!selection.empty()) {
+        title = fmtstring("{} ({})", title, selection);
+    }
 
-    ttree->SetEstimate(ttree->GetEntries());
-    Long64_t entriesDrawn = -1;
-    try {
-        entriesDrawn = ttree->Draw(varexp.expression.c_str(), selection.c_str(), option, nentries, firstentry);
+    const auto filled = getHistograms(title, ttree, varexps, selection, {}, nentries, firstentry);
+    if (filled.empty()) {
+        return;
+    }
+    plotGrid(filled, varexps, title);
+}
+
+void FileBrowser::plotGrid(const std::vector<const AutoHistogram*>& panels, const std::vector<std::string>& titles,
+                           const std::string& title) {
+    const PlottingScope scope(plotting);
+    clearAxisArea();
+
+    werase(main_window);
+    box(main_window, 0, 0);
+    // Terminal cells are about twice as high as wide, keep the plots near square
+    const int n = panels.size();
+    const double aspect = (mainwin_x - 2) / (2.0 * std::max(1, mainwin_y - 2));
+    const int cols = std::clamp(static_cast<int>(std::ceil(std::sqrt(n * aspect))), 1, n);
+    const int rows = (n + cols - 1) / cols;
+    const int width = (mainwin_x - 2) / cols;
+    const int height = (mainwin_y - 2) / rows;
+    for (int p = 0; p < n; ++p) {
+        plotPanel(*panels[p], titles[p], 1 + (p / cols) * height, 1 + (p % cols) * width, height, width);
+    }
+
+    wattron(main_window, A_ITALIC | A_BOLD);
+    if (logscale) {
+        mvwprintw(main_window, 0, 4, "┤ %s (log-y) ├", title.c_str());
     }
-    catch (...) {
-        console.setError("TTreeFormula Error");
+    else {
+        mvwprintw(main_window, 0, 4, "┤ %s ├", title.c_str());
+    }
+    wattroff(main_window, A_ITALIC | A_BOLD);
+    wrefresh(main_window);
+}
+
+void FileBrowser::clearAxisArea() {
+    getmaxyx(main_window, mainwin_y, mainwin_x);
+    const int winx = getbegx(main_window);
+    const int winy = getbegy(main_window);
+    for (int i = 0; i < mainwin_y; ++i) {
+        for (int j = 0; j < yaxis_spacing; ++j) {
+            mvaddch(winy + i, winx + j - yaxis_spacing, ' ');
+        }
+    }
+    move(winy - 1, winx);
+    clrtoeol();
+    move(winy + mainwin_y, 0);
+    clrtobot();
+    refresh();
+}
+
+void FileBrowser::plotSummary() {
+    const auto found = tree_summaries.find(summary_view.tree);
+    if (found == tree_summaries.end() || plotting) {
         return;
     }
+    const auto& leaves = found->second;
+    clearAxisArea();
+    werase(main_window);
+    box(main_window, 0, 0);
 
-    auto vector_branches = [ttree] (const char* form) -> TLeaf* {
-        // Check if formula involves vector branches
-        TTreeFormula formula("FORM", form, ttree);
-        for (int v = 0; v < formula.GetNdim(); ++v) {
-            if (TLeaf* leaf = formula.GetLeaf(v)->GetLeafCount(); leaf != nullptr) {
-                formula.Delete();
-                return leaf;
-            }
+    static const char* headers[] = {"Leaf", "Entries", "Min", "Max", "Mean", "RMS", "NaN/Inf", "Zero"};
+    auto value = [](const DrawEngine::LeafSummary& leaf, int column) -> double {
+        switch (column) {
+            case 1: return leaf.entries;
+            case 2: return leaf.min;
+            case 3: return leaf.max;
+            case 4: return leaf.mean;
+            case 5: return leaf.rms();
+            case 6: return leaf.nonfinite;
+            default: return leaf.zeroFraction();
         }
-        formula.Delete();
-        return nullptr;
     };
-
-    if (TLeaf* lenLeaf = vector_branches(varexp.expression.c_str()); lenLeaf != nullptr && false) {
-        // AFAIK, an efficient loop is required now
-        // SKIP!
-        TTreeFormula formula("FORM", varexp.expression.c_str(), ttree);
-        auto nEntriesTop = ttree->GetEntries();
-        Long64_t len;
-        ttree->SetBranchStatus(lenLeaf->GetName(), 1);
-        ttree->SetBranchAddress(lenLeaf->GetName(), &len);
-        for (int i = 0; i < nEntriesTop; ++i) {
-            ttree->GetEntry(i);
-
-        }
-    }
-    else if (entriesDrawn != -1) {
-        Double_t* data_y = ttree->GetV1();
-        Double_t* data_x = ttree->GetV2();
-        // This is a hack
-        Long64_t n = std::min<Long64_t>(ttree->GetSelectedRows(), ttree->GetEntries());
-        Double_t minx = *std::min_element(data_x, data_x + n);
-        Double_t miny = *std::min_element(data_y, data_y + n);
-        Double_t maxx = *std::max_element(data_x, data_x + n);
-        Double_t maxy = *std::max_element(data_y, data_y + n);
-
-        std::string title;
-        if (selection.empty()) {
-            title = varexp.expression;
+    std::vector<std::size_t> order(leaves.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        const auto& first = leaves[summary_view.descending ? b : a];
+        const auto& second = leaves[summary_view.descending ? a : b];
+        if (summary_view.column == 0) {
+            return first.name < second.name;
         }
-        else {
-            title = fmtstring("{} ({})", varexp.expression, selection);
-        }
-
-        TH2D hist2d;
-        if (!varexp.limits.empty()) {
-            minx = varexp.limits.at(0);
-            maxx = varexp.limits.at(1);
-            miny = varexp.limits.at(2);
-            maxy = varexp.limits.at(3);
-            hist2d = TH2D("TEMP", title.c_str(), bins_x, minx, maxx, bins_y, miny, maxy);
-            for (int i = 0; i < n; ++i) {
-                if (data_x[i] >= minx && data_x[i] <= maxx && data_y[i] >= miny && data_y[i] <= maxy) {
-                    hist2d.Fill(data_x[i], data_y[i]);
+        return value(first, summary_view.column) < value(second, summary_view.column);
+    });
+
+    // Name column takes the space left by the numbers
+    constexpr int number_width = 11;
+    const int width = mainwin_x - 2;
+    const int name_width = std::max(8, width - 7 * number_width);
+    std::string header = fmtstring("{:<{}.{}}", headers[0], name_width, name_width);
+    for (int c = 1; c < 8; ++c) {
+        header += fmtstring("{:>{}}", headers[c], number_width);
+    }
+    wattron(main_window, A_BOLD | A_UNDERLINE);
+    mvwaddnstr(main_window, 1, 1, header.c_str(), width);
+    wattroff(main_window, A_BOLD | A_UNDERLINE);
+    const int marker = summary_view.column == 0 ? 5 : name_width + summary_view.column * number_width;
+    if (marker < width) {
+        mvwprintw(main_window, 1, marker, "%s", summary_view.descending ? "▼" : "▲");
+    }
+
+    // Keep the leaf highlighted in the menu in view
+    std::optional<std::size_t> highlighted;
+    if (const auto entry = root_file.getEntry(object_menu.getSelectedEntryIndex(), searchMode.isActive); entry.has_value()) {
+        const auto& node = std::get<1>(*entry);
+        if (const int tree = root_file.treeIndex(node); node.type() == NodeType::TLEAF && tree >= 0
+            && root_file.m_trees.at(tree).isLoaded() && root_file.m_trees.at(tree).get() == summary_view.tree
+            && root_file.m_leaves.at(node.index()).get() != nullptr) {
+            const std::string leafname = root_file.m_leaves.at(node.index())->GetFullName();
+            for (std::size_t row = 0; row < order.size(); ++row) {
+                if (leaves[order[row]].name == leafname) {
+                    highlighted = row;
+                    break;
                 }
             }
-            hist2d.Draw("goff");
+        }
+    }
+    const int rows = std::max(0, mainwin_y - 3);
+    int top = 0;
+    if (highlighted.has_value() && static_cast<int>(*highlighted) >= rows) {
+        top = std::min<int>(*highlighted - rows / 2, static_cast<int>(order.size()) - rows);
+    }
+    for (int row = 0; row < rows && top + row < static_cast<int>(order.size()); ++row) {
+        const auto& leaf = leaves[order[top + row]];
+        std::string line = fmtstring("{:<{}.{}}", leaf.name, name_width, name_width - 1);
+        if (!leaf.summarized) {
+            line += fmtstring("{:>{}}", "not summarized", 2 * number_width);
         }
         else {
-            hist2d = TH2D("TEMP", title.c_str(), bins_x, minx, maxx, bins_y, miny, maxy);
-            hist2d.FillN(n, data_x, data_y, nullptr);
-            hist2d.Draw("goff");
+            line += fmtstring("{:>{}}", leaf.entries, number_width);
+            if (leaf.entries > 0) {
+                line += fmtstring("{:>{}.4g}{:>{}.4g}{:>{}.4g}{:>{}.4g}", leaf.min, number_width, leaf.max,
+                                  number_width, leaf.mean, number_width, leaf.rms(), number_width);
+            }
+            else {
+                line += std::string(4 * number_width, ' ');
+            }
+            line += fmtstring("{:>{}}{:>{}.1f}%", leaf.nonfinite, number_width, 100 * leaf.zeroFraction(),
+                              number_width - 1);
+        }
+        const bool selected = highlighted.has_value() && *highlighted == static_cast<std::size_t>(top + row);
+        if (selected) {
+            wattron(main_window, A_REVERSE);
         }
+        if (leaf.nonfinite > 0) {
+            wattron(main_window, COLOR_PAIR(col_red));
+        }
+        mvwaddnstr(main_window, 2 + row, 1, line.c_str(), width);
+        wattroff(main_window, A_REVERSE | COLOR_PAIR(col_red));
+    }
+
+    wattron(main_window, A_ITALIC | A_BOLD);
+    mvwprintw(main_window, 0, 4, "┤ %s: %zu leaves ├", summary_view.tree->GetName(), leaves.size());
+    wattroff(main_window, A_ITALIC | A_BOLD);
+    wrefresh(main_window);
+}
 
-        AxisTicks xaxis(minx, maxx);
-        AxisTicks yaxis(miny, maxy, 5, logscale);
+void FileBrowser::plotPanel(const AutoHistogram& filled, const std::string& title, int y, int x, int height, int width) {
+    // Title, one character column per bin, range of the x axis below
+    const int plot_h = height - 2;
+    const int plot_w = width - 1; // Gap to the next plot
+    if (plot_h < 1 || plot_w < 4) {
+        return;
+    }
+    wattron(main_window, A_BOLD);
+    mvwaddnstr(main_window, y, x, title.c_str(), plot_w);
+    wattroff(main_window, A_BOLD);
+    if (filled.empty()) {
+        mvwaddnstr(main_window, y + height / 2, x + std::max(0, plot_w / 2 - 3), "Empty", plot_w);
+        return;
+    }
 
-        plotYAxis(yaxis, true);
-        plotXAxis(xaxis, true);
-        plotASCIIHistogram2D(&hist2d, bins_y, bins_x);
-        plotCanvasAnnotations(&hist2d);
+    auto axisRange = [this, &filled](int axis, int nbins) {
+        auto [min, max] = plotRange(filled, axis);
+        if (!(min < max)) {
+            // Single value
+            min -= 0.5;
+            max += 0.5;
+        }
+        return filled.alignedRange(axis, min, max, nbins);
+    };
+    // Height of content relative to the highest bin
+    auto level = [this](double content, double top) {
+        if (content <= 0 || top <= 0) {
+            return 0.0;
+        }
+        return logscale ? std::log1p(content) / std::log1p(top) : std::min(content / top, 1.0);
+    };
+
+    const auto [minx, maxx] = axisRange(0, plot_w);
+    std::string range;
+    wattron(main_window, COLOR_PAIR(col_whiteblue));
+    if (filled.dimension() == 2) {
+        const auto [miny, maxy] = axisRange(1, plot_h);
+        TH2D hist("TEMP", "", plot_w, minx, maxx, plot_h, miny, maxy);
+        filled.project(hist);
+        double top = 0;
+        for (int i = 1; i <= plot_w; ++i) {
+            for (int j = 1; j <= plot_h; ++j) {
+                top = std::max(top, hist.GetBinContent(i, j));
+            }
+        }
+        static const char* shades[] = {" ", "░", "▒", "▓", "█"};
+        for (int i = 0; i < plot_w; ++i) {
+            for (int j = 0; j < plot_h; ++j) {
+                const int shade = std::ceil(level(hist.GetBinContent(i + 1, j + 1), top) * 4);
+                mvwaddstr(main_window, y + plot_h - j, x + i, shades[shade]);
+            }
+        }
+        range = fmtstring("x {:.3g}..{:.3g} y {:.3g}..{:.3g}", minx, maxx, miny, maxy);
     }
     else {
-        console.setError("Branch not found");
+        TH1D hist("TEMP", "", plot_w, minx, maxx);
+        filled.project(hist);
+        double top = 0;
+        for (int i = 1; i <= plot_w; ++i) {
+            top = std::max(top, hist.GetBinContent(i));
+        }
+        static const char* eighths[] = {" ", "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+        for (int i = 0; i < plot_w; ++i) {
+            const int bar = std::lround(level(hist.GetBinContent(i + 1), top) * plot_h * 8);
+            for (int j = 0; j < plot_h; ++j) {
+                mvwaddstr(main_window, y + plot_h - j, x + i, eighths[std::clamp(bar - 8 * j, 0, 8)]);
+            }
+        }
+        range = fmtstring("{:.4g} .. {:.4g}", minx, maxx);
+    }
+    wattroff(main_window, COLOR_PAIR(col_whiteblue));
+    mvwaddnstr(main_window, y + height - 1, x, range.c_str(), plot_w);
+}
+
+void FileBrowser::plotFilledHistogram2D(const AutoHistogram& filled, const std::string& title, const std::vector<double>& limits) {
+    const PlottingScope scope(plotting);
+    getmaxyx(main_window, mainwin_y, mainwin_x);
+    box(main_window, 0, 0);
+    if (filled.empty()) {
+        showEmpty();
+        refresh();
+        return;
     }
 
+    // Get bounds
+    auto bins_x = mainwin_x - 2;
+    auto bins_y = mainwin_y - 2;
+
+    auto [minx, maxx] = plotRange(filled, 0);
+    auto [miny, maxy] = plotRange(filled, 1);
+    if (!limits.empty()) {
+        minx = limits.at(0);
+        maxx = limits.at(1);
+        miny = limits.at(2);
+        maxy = limits.at(3);
+    }
+    std::tie(minx, maxx) = filled.alignedRange(0, minx, maxx, bins_x);
+    std::tie(miny, maxy) = filled.alignedRange(1, miny, maxy, bins_y);
+    TH2D hist2d("TEMP", title.c_str(), bins_x, minx, maxx, bins_y, miny, maxy);
+    filled.project(hist2d);
+
+    AxisTicks xaxis(minx, maxx);
+    AxisTicks yaxis(miny, maxy, 5, logscale);
+
+    plotYAxis(yaxis, true);
+    plotXAxis(xaxis, true);
+    plotASCIIHistogram2D(&hist2d, bins_y, bins_x);
+    plotCanvasAnnotations(&hist2d);
+
     refresh();
 }
 
@@ -747,7 +1365,7 @@ void FileBrowser::plotASCIIHistogram2D(TH2D* hist, int binsy, int binsx) {
     wrefresh(main_window);
 }
 
-void FileBrowser::plotCanvasAnnotations(TH1* hist) {
+void FileBrowser::plotCanvasAnnotations(TH1* hist, const AutoHistogram& filled) {
     // Plot Title
     // box(main_window, 0, 0);
     wattron(main_window, A_ITALIC | A_BOLD);
@@ -765,6 +1383,8 @@ void FileBrowser::plotCanvasAnnotations(TH1* hist) {
         mvwprintw(main_window, line++, mainwin_x - 30, "Entries: %f",   hist->GetEntries());
         mvwprintw(main_window, line++, mainwin_x - 30, "Mean:    %.5f", hist->GetMean());
         mvwprintw(main_window, line++, mainwin_x - 30, "Std:     %.5f", hist->GetStdDev());
+        mvwprintw(main_window, line++, mainwin_x - 30, "Median:  %.5f", filled.quantile(0.5));
+        mvwprintw(main_window, line++, mainwin_x - 30, "IQR:     %.5f", filled.quantile(0.75) - filled.quantile(0.25));
         mvwprintw(main_window, line++, mainwin_x - 30, "Bins:    %i",   hist->GetNbinsX());
     }
 
@@ -952,6 +1572,7 @@ void FileBrowser::handleInputEvent(MEVENT& mouse_event, int key) {
                 object_menu.moveDown();
             }
         }
+        followSelection();
         refreshCMDWindow();
         drawEssentials();
         return;
@@ -974,12 +1595,14 @@ void FileBrowser::handleInputEvent(MEVENT& mouse_event, int key) {
         if (SearchMode::isBranchChar(key)) {
             searchMode.input += static_cast<char>(key);
             updateSearchResults();
+            followSelection();
             return;
         }
         else if (key == KEY_BACKSPACE || key == KEY_DL) {
             if (!searchMode.input.empty()) {
                 searchMode.input.pop_back();
                 updateSearchResults();
+                followSelection();
                 return;
             }
         }
@@ -1009,6 +1632,12 @@ void FileBrowser::handleInputEvent(MEVENT& mouse_event, int key) {
         case 'q':
             is_running = false;
             break;
+        case 27: // ESCAPE
+            if (draw_job != nullptr && !draw_job->speculative) {
+                cancelDraw();
+                console.setError("Draw cancelled");
+            }
+            break;
         case '/':
             searchMode.isActive = !searchMode.isActive;
             if (searchMode.isActive) {
@@ -1030,6 +1659,25 @@ void FileBrowser::handleInputEvent(MEVENT& mouse_event, int key) {
             toggleBlockMode();
             plotHistogram();
             break;
+        case 'p':
+            toggleSampleOnly();
+            plotHistogram();
+            break;
+        case 'r':
+            toggleRobustRange();
+            replot();
+            break;
+        case 'D':
+            describeTree();
+            break;
+        case 'o':
+            cycleSummaryColumn();
+            replot();
+            break;
+        case 'O':
+            reverseSummaryOrder();
+            replot();
+            break;
         case 'd':
             console.entering_draw_command = true;
             break;
@@ -1050,6 +1698,7 @@ void FileBrowser::handleInputEvent(MEVENT& mouse_event, int key) {
             invalid_key = true;
             break;
     }
+    followSelection();
     refreshCMDWindow();
     drawEssentials();
 
@@ -1066,24 +1715,37 @@ void FileBrowser::handleInputEvent(MEVENT& mouse_event, int key) {
     refresh();
 }
 
-void FileBrowser::updateSearchResults() {
-    for (auto& [name, node] : root_file.displayList) {
-        if (node->type == NodeType::TLEAF) {
-            node->showInSearch = string_contains(name, searchMode.input);
-        }
-        else {
-            node->showInSearch = false; // Make sure this is always hidden
+void FileBrowser::followSelection() {
+    RootFile::Node leaf;
+    if (const auto entry = root_file.getEntry(object_menu.getSelectedEntryIndex(), searchMode.isActive); entry.has_value()) {
+        if (const auto& node = std::get<1>(*entry); node.type() == NodeType::TLEAF) {
+            leaf = node;
         }
     }
+    if (leaf == prefetch_state.leaf) {
+        return;
+    }
+    prefetch_state.leaf = leaf;
+    if (summary_view.tree != nullptr) {
+        plotSummary();
+    }
+    // Prefetch of the previous leaf is of no use anymore
+    if (draw_job != nullptr && draw_job->speculative) {
+        cancelDraw();
+    }
+    prefetch_state.pending = prefetch && leaf.id() != RootFile::no_node;
+    prefetch_state.due = std::chrono::steady_clock::now() + prefetch_delay;
+}
+
+void FileBrowser::updateSearchResults() {
+    root_file.search(searchMode.input);
     object_menu.setMenuExtent(root_file.menuLength(true), getmaxy(dir_window) - 2);
 }
 
 void FileBrowser::setAllSearchResultTrue() {
     // Show all search results on launch
     if (searchMode.input.empty()) {
-        for (auto& [name, node] : root_file.displayList) {
-            node->showInSearch = node->type == NodeType::TLEAF;
-        }
+        root_file.search("");
     }
 }
 
@@ -1118,6 +1780,7 @@ void FileBrowser::handleResize(bool force) {
         refresh();
 
         getmaxyx(main_window, mainwin_y, mainwin_x);
+        replot();
     }
 }
 
@@ -1140,14 +1803,19 @@ void FileBrowser::handleMenuSelect() {
     }
 
     auto& [name, node] = fetch.value();
-    if (node->type == NodeType::DIRECTORY || node->type == NodeType::TTREE) {
-        node->toggleOpenOnClick();
+    if (is_container(node.type())) {
+        const bool firstOpen = !node.populated();
+        root_file.toggleOpen(node);
+        if (firstOpen && node.type() != NodeType::DIRECTORY) {
+            // Branches of this tree are known now
+            console.setTabCompletionDict(root_file.displayList);
+        }
         object_menu.setMenuExtent(root_file.menuLength(searchMode.isActive), getmaxy(dir_window) - 2);
     }
-    else if (node->type == NodeType::TLEAF) {
+    else if (node.type() == NodeType::TLEAF) {
         console.clearCommand();
-        plotHistogram(root_file.m_trees.at(node->mother->index), 
-                      root_file.m_leaves.at(node->index));
+        plotHistogram(root_file.m_trees.at(root_file.treeIndex(node)).get(), 
+                      root_file.m_leaves.at(node.index()).get());
     }
 }
 
@@ -1175,7 +1843,12 @@ void FileBrowser::helpWindow() {
     helpline("Go to bottom ......... <G>");
     helpline("Plot selected ........ <ENTER/LMB>");
     helpline("Cycle graphics mode .. <t>");
+    helpline("Sample only preview .. <p>");
+    helpline("Robust range ......... <r>");
+    helpline("Describe tree ........ <D>");
+    helpline("Sort/reverse table ... <o/O>");
     helpline("Resize object menu ... <F1/F2>");
+    helpline("Cancel running draw .. <ESC>");
     helpline("Quit ................. <q/Ctrl+C>");
 
     line = 0;
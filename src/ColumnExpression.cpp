@@ -0,0 +1,409 @@
+#include "ColumnExpression.h"
+#include "definitions.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <utility>
+
+namespace {
+    using Func1 = double (*)(double);
+    using Func2 = double (*)(double, double);
+
+    struct Function1 {
+        std::string_view name;
+        const char* cxx; // Spelling in compiled kernels
+        Func1 func;
+    };
+    struct Function2 {
+        std::string_view name;
+        const char* cxx;
+        Func2 func;
+    };
+
+    constexpr Function1 functions1[] = {
+        {"sqrt",  "std::sqrt",  [](double x) { return std::sqrt(x); }},
+        {"abs",   "std::fabs",  [](double x) { return std::fabs(x); }},
+        {"fabs",  "std::fabs",  [](double x) { return std::fabs(x); }},
+        {"exp",   "std::exp",   [](double x) { return std::exp(x); }},
+        {"log",   "std::log",   [](double x) { return std::log(x); }},
+        {"log10", "std::log10", [](double x) { return std::log10(x); }},
+        {"sin",   "std::sin",   [](double x) { return std::sin(x); }},
+        {"cos",   "std::cos",   [](double x) { return std::cos(x); }},
+        {"tan",   "std::tan",   [](double x) { return std::tan(x); }},
+        {"asin",  "std::asin",  [](double x) { return std::asin(x); }},
+        {"acos",  "std::acos",  [](double x) { return std::acos(x); }},
+        {"atan",  "std::atan",  [](double x) { return std::atan(x); }},
+        {"sinh",  "std::sinh",  [](double x) { return std::sinh(x); }},
+        {"cosh",  "std::cosh",  [](double x) { return std::cosh(x); }},
+        {"tanh",  "std::tanh",  [](double x) { return std::tanh(x); }},
+        {"floor", "std::floor", [](double x) { return std::floor(x); }},
+        {"ceil",  "std::ceil",  [](double x) { return std::ceil(x); }},
+        {"TMath::Sqrt",  "std::sqrt",  [](double x) { return std::sqrt(x); }},
+        {"TMath::Abs",   "std::fabs",  [](double x) { return std::fabs(x); }},
+        {"TMath::Exp",   "std::exp",   [](double x) { return std::exp(x); }},
+        {"TMath::Log",   "std::log",   [](double x) { return std::log(x); }},
+        {"TMath::Log10", "std::log10", [](double x) { return std::log10(x); }},
+        {"TMath::Sin",   "std::sin",   [](double x) { return std::sin(x); }},
+        {"TMath::Cos",   "std::cos",   [](double x) { return std::cos(x); }},
+        {"TMath::Tan",   "std::tan",   [](double x) { return std::tan(x); }},
+        {"TMath::ASin",  "std::asin",  [](double x) { return std::asin(x); }},
+        {"TMath::ACos",  "std::acos",  [](double x) { return std::acos(x); }},
+        {"TMath::ATan",  "std::atan",  [](double x) { return std::atan(x); }},
+        {"TMath::Floor", "std::floor", [](double x) { return std::floor(x); }},
+        {"TMath::Ceil",  "std::ceil",  [](double x) { return std::ceil(x); }},
+    };
+    constexpr Function2 functions2[] = {
+        {"pow",          "std::pow",   [](double x, double y) { return std::pow(x, y); }},
+        {"TMath::Power", "std::pow",   [](double x, double y) { return std::pow(x, y); }},
+        {"atan2",        "std::atan2", [](double y, double x) { return std::atan2(y, x); }},
+        {"TMath::ATan2", "std::atan2", [](double y, double x) { return std::atan2(y, x); }},
+        {"fmod",         "std::fmod",  [](double x, double y) { return std::fmod(x, y); }},
+    };
+}
+
+// Recursive descent in C precedence, emits postfix code. Any unsupported
+// syntax fails the whole parse
+class ColumnExpression::Parser {
+public:
+    Parser(std::string_view text, ColumnExpression& expr) : m_text(text), m_expr(expr) { }
+
+    bool parse() {
+        return parseOr() && (skipSpace(), m_pos == m_text.size());
+    }
+
+private:
+    void skipSpace() {
+        while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos]))) {
+            ++m_pos;
+        }
+    }
+
+    // Consumes token if it is next, but not the start of a longer operator
+    bool accept(std::string_view token, std::string_view notFollowedBy = "") {
+        skipSpace();
+        if (m_text.substr(m_pos, token.size()) != token) {
+            return false;
+        }
+        const std::size_t next = m_pos + token.size();
+        if (next < m_text.size() && notFollowedBy.find(m_text[next]) != std::string_view::npos) {
+            return false;
+        }
+        m_pos = next;
+        return true;
+    }
+
+    void emit(Op op) {
+        m_expr.m_program.push_back(op);
+        switch (op.code) {
+            case OpCode::COLUMN: case OpCode::CONSTANT: ++m_depth; break;
+            case OpCode::NEG: case OpCode::NOT: case OpCode::FUNC1: break;
+            default: --m_depth; break;
+        }
+        m_expr.m_stackDepth = std::max(m_expr.m_stackDepth, m_depth);
+    }
+
+    bool parseOr() {
+        if (!parseAnd()) { return false; }
+        while (accept("||")) {
+            if (!parseAnd()) { return false; }
+            emit({OpCode::OR});
+        }
+        return true;
+    }
+
+    bool parseAnd() {
+        if (!parseEquality()) { return false; }
+        while (accept("&&")) {
+            if (!parseEquality()) { return false; }
+            emit({OpCode::AND});
+        }
+        return true;
+    }
+
+    bool parseEquality() {
+        if (!parseRelational()) { return false; }
+        while (true) {
+            OpCode code;
+            if (accept("==")) { code = OpCode::EQ; }
+            else if (accept("!=")) { code = OpCode::NE; }
+            else if (accept("=")) { code = OpCode::EQ; } // TTreeFormula reads "=" as "=="
+            else { return true; }
+            if (!parseRelational()) { return false; }
+            emit({code});
+        }
+    }
+
+    bool parseRelational() {
+        if (!parseAdditive()) { return false; }
+        while (true) {
+            OpCode code;
+            if (accept("<=")) { code = OpCode::LE; }
+            else if (accept(">=")) { code = OpCode::GE; }
+            else if (accept("<", "<")) { code = OpCode::LT; }
+            else if (accept(">", ">")) { code = OpCode::GT; }
+            else { return true; }
+            if (!parseAdditive()) { return false; }
+            emit({code});
+        }
+    }
+
+    bool parseAdditive() {
+        if (!parseMultiplicative()) { return false; }
+        while (true) {
+            OpCode code;
+            if (accept("+")) { code = OpCode::ADD; }
+            else if (accept("-")) { code = OpCode::SUB; }
+            else { return true; }
+            if (!parseMultiplicative()) { return false; }
+            emit({code});
+        }
+    }
+
+    bool parseMultiplicative() {
+        if (!parseUnary()) { return false; }
+        while (true) {
+            OpCode code;
+            if (accept("*")) { code = OpCode::MUL; }
+            else if (accept("/")) { code = OpCode::DIV; }
+            else { return true; }
+            if (!parseUnary()) { return false; }
+            emit({code});
+        }
+    }
+
+    bool parseUnary() {
+        if (accept("-")) {
+            if (!parseUnary()) { return false; }
+            emit({OpCode::NEG});
+            return true;
+        }
+        if (accept("+")) {
+            return parseUnary();
+        }
+        if (accept("!", "=")) {
+            if (!parseUnary()) { return false; }
+            emit({OpCode::NOT});
+            return true;
+        }
+        return parsePrimary();
+    }
+
+    bool parsePrimary() {
+        skipSpace();
+        if (m_pos >= m_text.size()) {
+            return false;
+        }
+        if (accept("(")) {
+            return parseOr() && accept(")");
+        }
+        const char c = m_text[m_pos];
+        if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+            const std::string number(m_text.substr(m_pos));
+            char* end = nullptr;
+            const double value = std::strtod(number.c_str(), &end);
+            if (end == number.c_str()) {
+                return false;
+            }
+            m_pos += end - number.c_str();
+            emit({OpCode::CONSTANT, 0, value});
+            return true;
+        }
+        if (!std::isalpha(static_cast<unsigned char>(c)) && c != '_') {
+            return false; // E.g. specials like Entry$ or Length$
+        }
+
+        const std::size_t start = m_pos;
+        while (m_pos < m_text.size()) {
+            const char n = m_text[m_pos];
+            if (std::isalnum(static_cast<unsigned char>(n)) || n == '_' || n == '.') {
+                ++m_pos;
+            }
+            else if (m_text.substr(m_pos, 2) == "::") {
+                m_pos += 2;
+            }
+            else {
+                break;
+            }
+        }
+        const std::string_view name = m_text.substr(start, m_pos - start);
+        if (accept("(")) {
+            return parseCall(name);
+        }
+        skipSpace();
+        if (m_pos < m_text.size() && (m_text[m_pos] == '[' || m_text[m_pos] == '$')) {
+            return false; // Arrays are not cached
+        }
+
+        auto& columns = m_expr.m_columns;
+        const auto found = std::find(columns.begin(), columns.end(), name);
+        emit({OpCode::COLUMN, static_cast<std::size_t>(found - columns.begin())});
+        if (found == columns.end()) {
+            columns.emplace_back(name);
+        }
+        return true;
+    }
+
+    bool parseCall(std::string_view name) {
+        for (const auto& function : functions1) {
+            if (function.name == name) {
+                if (!parseOr() || !accept(")")) { return false; }
+                emit({OpCode::FUNC1, 0, 0, function.func, nullptr, function.cxx});
+                return true;
+            }
+        }
+        for (const auto& function : functions2) {
+            if (function.name == name) {
+                if (!parseOr() || !accept(",") || !parseOr() || !accept(")")) { return false; }
+                emit({OpCode::FUNC2, 0, 0, nullptr, function.func, function.cxx});
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string_view m_text;
+    std::size_t m_pos = 0;
+    std::size_t m_depth = 0;
+    ColumnExpression& m_expr;
+};
+
+std::optional<ColumnExpression> ColumnExpression::parse(const std::string& expression) {
+    ColumnExpression expr;
+    if (!Parser(expression, expr).parse() || expr.m_program.empty()) {
+        return std::nullopt;
+    }
+    return expr;
+}
+
+const std::vector<std::string>& ColumnExpression::columns() const {
+    return m_columns;
+}
+
+std::string ColumnExpression::source() const {
+    std::vector<std::string> stack;
+    // "(a op b)", comparisons and logic as "double(...)" like the interpreted ops
+    auto binary = [&](const char* op, bool boolean = false) {
+        std::string b = std::move(stack.back());
+        stack.pop_back();
+        std::string& a = stack.back();
+        a = (boolean ? "double(" : "(") + a + op + b + ")";
+    };
+    // Zero divisor gives 0 like the interpreted op. Through a lambda, so the
+    // divisor is not spelled out twice in nested divisions
+    auto divide = [&]() {
+        std::string b = std::move(stack.back());
+        stack.pop_back();
+        std::string& a = stack.back();
+        a = "[](double a, double b) { return b == 0 ? 0.0 : a / b; }(" + a + ", " + b + ")";
+    };
+    auto logic = [&](const char* op) {
+        std::string b = std::move(stack.back());
+        stack.pop_back();
+        std::string& a = stack.back();
+        a = "double(" + a + " != 0" + op + b + " != 0)";
+    };
+    for (const Op& op : m_program) {
+        switch (op.code) {
+            case OpCode::COLUMN:
+                stack.push_back("c[" + std::to_string(op.column) + "][i]");
+                break;
+            case OpCode::CONSTANT:
+                if (is_finite(op.value)) {
+                    char literal[32];
+                    std::snprintf(literal, sizeof(literal), "%a", op.value); // Hex float, exact
+                    stack.push_back(literal);
+                }
+                else {
+                    stack.push_back(op.value > 0 ? "(1.0 / 0.0)" : "(-1.0 / 0.0)");
+                }
+                break;
+            case OpCode::NEG:   stack.back() = "(-" + stack.back() + ")"; break;
+            case OpCode::NOT:   stack.back() = "double(" + stack.back() + " == 0)"; break;
+            case OpCode::FUNC1: stack.back() = std::string(op.name) + "(" + stack.back() + ")"; break;
+            case OpCode::ADD:   binary(" + "); break;
+            case OpCode::SUB:   binary(" - "); break;
+            case OpCode::MUL:   binary(" * "); break;
+            case OpCode::DIV:   divide(); break;
+            case OpCode::LT:    binary(" < ", true); break;
+            case OpCode::LE:    binary(" <= ", true); break;
+            case OpCode::GT:    binary(" > ", true); break;
+            case OpCode::GE:    binary(" >= ", true); break;
+            case OpCode::EQ:    binary(" == ", true); break;
+            case OpCode::NE:    binary(" != ", true); break;
+            case OpCode::AND:   logic(" && "); break;
+            case OpCode::OR:    logic(" || "); break;
+            case OpCode::FUNC2: binary(", "); stack.back() = op.name + stack.back(); break;
+        }
+    }
+    return stack.front();
+}
+
+void ColumnExpression::setKernel(Kernel kernel) {
+    m_kernel = kernel;
+}
+
+bool ColumnExpression::compiled() const {
+    return m_kernel != nullptr;
+}
+
+void ColumnExpression::evaluate(const std::vector<const double*>& columns, std::size_t first, std::size_t n,
+                                double* out) const {
+    if (m_kernel != nullptr) {
+        m_kernel(columns.data(), first, n, out);
+        return;
+    }
+    // Called per block from the draw threads, the stack of n values per level
+    // is kept per thread and only grows
+    thread_local std::vector<double> scratch;
+    if (scratch.size() < m_stackDepth * n) {
+        scratch.resize(m_stackDepth * n);
+    }
+    auto stack = [n](std::size_t level) { return scratch.data() + level * n; };
+    std::size_t top = 0;
+    auto binary = [&](auto op) {
+        double* a = stack(top - 2);
+        const double* b = stack(top - 1);
+        for (std::size_t i = 0; i < n; ++i) {
+            a[i] = op(a[i], b[i]);
+        }
+        --top;
+    };
+    auto unary = [&](auto op) {
+        double* a = stack(top - 1);
+        for (std::size_t i = 0; i < n; ++i) {
+            a[i] = op(a[i]);
+        }
+    };
+
+    for (const Op& op : m_program) {
+        switch (op.code) {
+            case OpCode::COLUMN:
+                std::copy_n(columns[op.column] + first, n, stack(top++));
+                break;
+            case OpCode::CONSTANT:
+                std::fill_n(stack(top++), n, op.value);
+                break;
+            case OpCode::NEG:   unary([](double a) { return -a; }); break;
+            case OpCode::NOT:   unary([](double a) { return double(a == 0); }); break;
+            case OpCode::FUNC1: unary(op.func1); break;
+            case OpCode::ADD:   binary([](double a, double b) { return a + b; }); break;
+            case OpCode::SUB:   binary([](double a, double b) { return a - b; }); break;
+            case OpCode::MUL:   binary([](double a, double b) { return a * b; }); break;
+            // Division by zero gives 0, like in TTreeFormula
+            case OpCode::DIV:   binary([](double a, double b) { return b == 0 ? 0.0 : a / b; }); break;
+            case OpCode::LT:    binary([](double a, double b) { return double(a < b); }); break;
+            case OpCode::LE:    binary([](double a, double b) { return double(a <= b); }); break;
+            case OpCode::GT:    binary([](double a, double b) { return double(a > b); }); break;
+            case OpCode::GE:    binary([](double a, double b) { return double(a >= b); }); break;
+            case OpCode::EQ:    binary([](double a, double b) { return double(a == b); }); break;
+            case OpCode::NE:    binary([](double a, double b) { return double(a != b); }); break;
+            case OpCode::AND:   binary([](double a, double b) { return double(a != 0 && b != 0); }); break;
+            case OpCode::OR:    binary([](double a, double b) { return double(a != 0 || b != 0); }); break;
+            case OpCode::FUNC2: binary(op.func2); break;
+        }
+    }
+    std::copy_n(stack(0), n, out);
+}
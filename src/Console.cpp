@@ -11,7 +11,7 @@
 #include "definitions.h"
 
 Console::Console() {
-    const std::string chars = " \",._<>()[]=!&|?+-*/%:@$";
+    const std::string chars = " \",._<>()[]=!&|?+-*/%:;@$";
     for (char c : chars) { allowed_chars.insert(c); }
 }
 
@@ -60,7 +60,24 @@ Console::FirstDrawArg::FirstDrawArg(std::string ex) {
         error_code = LimitError::LimitNumber;
     }
 
-    const int ncolon = std::count(expression.begin(), expression.end(), ':');
+    const auto parts = split(expression);
+    if (parts.size() == 1) {
+        expression = parts[0]; // Trailing ';'
+    }
+    else if (parts.size() > 1) {
+        multiple = true;
+        if (!limits.empty()) {
+            error_code = LimitError::MultipleWithLimits;
+        }
+        for (const auto& part : parts) {
+            if (split_varexp(part).size() > 2) {
+                error_code = LimitError::No3DHists;
+            }
+        }
+        return;
+    }
+
+    const int ncolon = split_varexp(expression).size() - 1;
     if (ncolon > 0) {
         if (ncolon > 1) {
             error_code = LimitError::No3DHists;
@@ -74,6 +91,22 @@ Console::FirstDrawArg::FirstDrawArg(std::string ex) {
     }
 }
 
+std::vector<std::string> Console::FirstDrawArg::split(const std::string& expression) {
+    std::vector<std::string> parts;
+    std::size_t begin = 0;
+    while (begin <= expression.size()) {
+        const auto end = std::min(expression.find(';', begin), expression.size());
+        // Surrounding whitespace is dropped, "a; ;b" has two parts
+        const auto first = expression.find_first_not_of(" \t", begin);
+        if (first < end) {
+            const auto last = expression.find_last_not_of(" \t", end - 1);
+            parts.push_back(expression.substr(first, last + 1 - first));
+        }
+        begin = end + 1;
+    }
+    return parts;
+}
+
 bool Console::parse() {
     if (current_input.empty()) {
         has_command = false;
@@ -135,6 +168,9 @@ bool Console::parse() {
         case FirstDrawArg::LimitError::InsufficientLimits: 
             last_error = "Zero or Four limits are required to draw a 2d histogram "; 
             break;
+        case FirstDrawArg::LimitError::MultipleWithLimits:
+            last_error = "Limits cannot be combined with several expressions.";
+            break;
     }
     valid = std::get<0>(current_args).error_code == FirstDrawArg::LimitError::NoError;
     if (!valid) {
@@ -186,6 +222,7 @@ bool Console::parse() {
 }
 
 void Console::setTabCompletionDict(const std::vector<RootFile::MenuItem>& dict) {
+    branch_names.clear();
     branch_names.reserve(dict.size());
     for (const auto& [name, node] : dict) {
         branch_names.push_back(name);
@@ -217,7 +254,7 @@ void Console::tabComplete() {
         std::reverse(partial.begin(), partial.end());
         for (auto& b : branch_names) {
             if (b.starts_with(partial)) {
-                matches.push_back(b);
+                matches.emplace_back(b);
             }
         }
     }
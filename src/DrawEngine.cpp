@@ -0,0 +1,1456 @@
+#include "DrawEngine.h"
+#include "ColumnExpression.h"
+#include "definitions.h"
+#include "TBranch.h"
+#include "TBranchElement.h"
+#include "TLeaf.h"
+#include "TLeafC.h"
+#include "TTreeFormula.h"
+#include "TTreeFormulaManager.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+// Smaller trees are not worth opening the file again per thread
+static constexpr Long64_t min_parallel_entries = 100000;
+static constexpr int tasks_per_thread = 4;
+// Entries evaluated at once from cached columns
+static constexpr std::size_t column_block = 4096;
+// Entries read ahead at once, and chunks held per reader
+static constexpr Long64_t prefetch_chunk = 16384;
+static constexpr int prefetch_chunks = 3;
+
+namespace {
+    // Lock of a tree shared with other threads, none for an own copy
+    std::unique_lock<std::recursive_mutex> lockTree(std::recursive_mutex* io) {
+        return io != nullptr ? std::unique_lock(*io) : std::unique_lock<std::recursive_mutex>();
+    }
+
+    // Variable length leaf ("x[n]/F") drawn without formulas. All elements,
+    // one element "x[2]" or the length "Length$(x)"
+    struct JaggedColumn {
+        enum class Mode { ELEMENTS, ELEMENT, LENGTH };
+
+        // Empty if varexp is not a plain variable length leaf. 2D draws are
+        // left to the formulas, which pair the elements of both leaves
+        static std::optional<JaggedColumn> parse(TTree* tree, const std::string& varexp);
+
+        void fill(TTree* tree, Long64_t first, Long64_t last, AutoHistogram& hist);
+        // False past the end of the tree
+        bool fillEntry(TTree* tree, Long64_t entry, double weight, AutoHistogram& hist);
+
+        std::string name;
+        // Leaves of the current tree of a chain
+        int treeNumber = -1;
+        TLeaf* leaf = nullptr;
+        TLeaf* count = nullptr;
+        Mode mode = Mode::ELEMENTS;
+        int index = 0;
+        // Typed loop over the payload array
+        void (*fillValues)(const void* data, int begin, int end, double weight, AutoHistogram& hist) = nullptr;
+    };
+
+    template <typename T>
+    void fillTyped(const void* data, int begin, int end, double weight, AutoHistogram& hist) {
+        const T* values = static_cast<const T*>(data);
+        for (int i = begin; i < end; ++i) {
+            hist.fill(static_cast<double>(values[i]), weight);
+        }
+    }
+
+    std::optional<JaggedColumn> JaggedColumn::parse(TTree* tree, const std::string& varexp) {
+        if (split_varexp(varexp).size() != 1) {
+            return std::nullopt;
+        }
+        JaggedColumn column;
+        std::string name = varexp;
+        if (name.starts_with("Length$(") && name.ends_with(")")) {
+            column.mode = Mode::LENGTH;
+            name = name.substr(8, name.size() - 9);
+        }
+        else if (const auto open = name.find('['); open != std::string::npos && name.ends_with("]")) {
+            const std::string index = name.substr(open + 1, name.size() - open - 2);
+            if (index.empty() || !std::all_of(index.begin(), index.end(), [](char c) { return std::isdigit(c); })) {
+                return std::nullopt;
+            }
+            column.mode = Mode::ELEMENT;
+            column.index = std::stoi(index);
+            name = name.substr(0, open);
+        }
+
+        column.name = name;
+        column.leaf = tree->GetLeaf(name.c_str());
+        if (column.leaf == nullptr || dynamic_cast<TBranchElement*>(column.leaf->GetBranch()) != nullptr) {
+            return std::nullopt; // Objects are left to the formulas
+        }
+        column.count = column.leaf->GetLeafCount();
+        if (column.count == nullptr || column.leaf->GetLenStatic() != 1) {
+            return std::nullopt;
+        }
+
+        static const std::pair<const char*, void (*)(const void*, int, int, double, AutoHistogram&)> types[] = {
+            {"Float_t", fillTyped<Float_t>},   {"Double_t", fillTyped<Double_t>},
+            {"Int_t", fillTyped<Int_t>},       {"UInt_t", fillTyped<UInt_t>},
+            {"Long64_t", fillTyped<Long64_t>}, {"ULong64_t", fillTyped<ULong64_t>},
+            {"Short_t", fillTyped<Short_t>},   {"UShort_t", fillTyped<UShort_t>},
+            {"Char_t", fillTyped<Char_t>},     {"UChar_t", fillTyped<UChar_t>},
+            {"Bool_t", fillTyped<Bool_t>},
+        };
+        for (const auto& [type, fill] : types) {
+            if (std::strcmp(column.leaf->GetTypeName(), type) == 0) {
+                column.fillValues = fill;
+            }
+        }
+        if (column.fillValues == nullptr) {
+            return std::nullopt;
+        }
+        return column;
+    }
+
+    void JaggedColumn::fill(TTree* tree, Long64_t first, Long64_t last, AutoHistogram& hist) {
+        for (Long64_t entry = first; entry < last; ++entry) {
+            if (!fillEntry(tree, entry, 1.0, hist)) {
+                break;
+            }
+        }
+    }
+
+    bool JaggedColumn::fillEntry(TTree* tree, Long64_t entry, double weight, AutoHistogram& hist) {
+        // Entry in the current tree, the leaves change with it in a chain
+        const Long64_t local = tree->LoadTree(entry);
+        if (local < 0) {
+            return false;
+        }
+        if (tree->GetTreeNumber() != treeNumber) {
+            treeNumber = tree->GetTreeNumber();
+            leaf = tree->GetLeaf(name.c_str());
+            count = leaf != nullptr ? leaf->GetLeafCount() : nullptr;
+            if (count == nullptr) {
+                throw std::runtime_error(fmtstring("Leaf {} changes type within the chain", name));
+            }
+        }
+        // The length alone does not need the payload to be decompressed
+        if (count->GetBranch()->GetEntry(local) <= 0) {
+            return false;
+        }
+        const int length = static_cast<int>(count->GetValue());
+        if (mode == Mode::LENGTH) {
+            hist.fill(length, weight);
+            return true;
+        }
+        if (mode == Mode::ELEMENT && index >= length) {
+            return true;
+        }
+        leaf->GetBranch()->GetEntry(local);
+        if (mode == Mode::ELEMENT) {
+            fillValues(leaf->GetValuePointer(), index, index + 1, weight, hist);
+        }
+        else {
+            fillValues(leaf->GetValuePointer(), 0, length, weight, hist);
+        }
+        return true;
+    }
+
+    // Expressions that only use scalar leaves, which can be cached as columns
+    struct ColumnPlan {
+        std::optional<ColumnExpression> varx;
+        std::optional<ColumnExpression> vary;
+        std::optional<ColumnExpression> select;
+        std::vector<std::string> leaves;
+    };
+
+    // Compiled varexp and selection of one tree
+    struct Formulas {
+        Formulas(TTree* tree, const std::string& varexp, const std::string& selection);
+
+        // Fill entries [first, last) into hist
+        void fill(TTree* tree, Long64_t first, Long64_t last, AutoHistogram& hist);
+        // Fill only these entries with their weights, the selection was applied before
+        void fill(TTree* tree, const std::vector<Long64_t>& entries, const std::vector<double>& weights,
+                  AutoHistogram& hist);
+        // Also copy the values of these leaves, values[i][entry]
+        void record(TTree* tree, const std::vector<std::string>& leaves, std::vector<std::vector<double>>& values);
+        // Evaluate the plan on blocks of leaf values instead of the formulas,
+        // see ColumnPipeline
+        void useColumns(TTree* tree, const ColumnPlan& plan);
+        // Adds the branches read by the formulas to the tree cache, so that
+        // formulas filled one after another over a cluster share its baskets
+        void cacheBranches(TTree* tree) const;
+        // Values of the plan leaves for [first, last) into values[leaf][entry - first],
+        // returns the end of the entries read
+        Long64_t readColumns(TTree* tree, Long64_t first, Long64_t last, std::vector<std::vector<double>>& values);
+
+        std::optional<JaggedColumn> jagged; // Used instead of the formulas if set
+        std::vector<std::pair<TLeaf*, double*>> recorded; // In the order of the plan leaves
+        bool truncated = false; // An entry could not be loaded, recorded values have gaps
+        const ColumnPlan* columns = nullptr;
+        std::vector<TLeaf*> columnLeaves;
+        std::unique_ptr<TTreeFormula> varx;
+        std::unique_ptr<TTreeFormula> vary;
+        std::unique_ptr<TTreeFormula> select;
+        TTreeFormulaManager* manager = nullptr; // Owned by the formulas
+    };
+
+    std::unique_ptr<TTreeFormula> compile(const char* name, const std::string& expression, TTree* tree) {
+        auto formula = std::make_unique<TTreeFormula>(name, expression.c_str(), tree);
+        if (formula->GetNdim() == 0) {
+            throw std::runtime_error("TTreeFormula Error");
+        }
+        return formula;
+    }
+
+    Formulas::Formulas(TTree* tree, const std::string& varexp, const std::string& selection) {
+        if (selection.empty()) {
+            jagged = JaggedColumn::parse(tree, varexp);
+            if (jagged) {
+                return;
+            }
+        }
+        // "y:x" is drawn as 2D, the console rejects more dimensions
+        if (const auto dims = split_varexp(varexp); dims.size() == 2) {
+            vary = compile("vary", dims[0], tree);
+            varx = compile("varx", dims[1], tree);
+        }
+        else {
+            varx = compile("varx", varexp, tree);
+        }
+        if (!selection.empty()) {
+            select = compile("select", selection, tree);
+        }
+        // Keeps array sizes of all formulas in sync
+        manager = new TTreeFormulaManager;
+        for (auto* formula : {varx.get(), vary.get(), select.get()}) {
+            if (formula != nullptr) {
+                manager->Add(formula);
+            }
+        }
+        manager->Sync();
+    }
+
+    void Formulas::fill(TTree* tree, Long64_t first, Long64_t last, AutoHistogram& hist) {
+        if (jagged) {
+            jagged->fill(tree, first, last, hist);
+            return;
+        }
+        for (Long64_t entry = first; entry < last; ++entry) {
+            const Long64_t local = tree->LoadTree(entry);
+            if (local < 0) {
+                truncated = true;
+                break;
+            }
+            for (auto& [leaf, values] : recorded) {
+                leaf->GetBranch()->GetEntry(local);
+                values[entry] = leaf->GetValue(0);
+            }
+            // Reads the branches used by the formulas, each basket once
+            const int ndata = manager->GetNdata();
+            if (ndata == 0) {
+                continue;
+            }
+            // Instance 0 loads the branch data of a formula, so it is evaluated
+            // for all of them before any instance can be skipped
+            const double weight = select ? select->EvalInstance(0) : 1.0;
+            const double x = varx->EvalInstance(0);
+            const double y = vary ? vary->EvalInstance(0) : 0.0;
+            if (weight != 0) {
+                if (vary) {
+                    hist.fill(x, y, weight);
+                }
+                else {
+                    hist.fill(x, weight);
+                }
+            }
+            for (int i = 1; i < ndata; ++i) {
+                const double w = select ? select->EvalInstance(i) : 1.0;
+                if (w == 0) {
+                    continue;
+                }
+                if (vary) {
+                    hist.fill(varx->EvalInstance(i), vary->EvalInstance(i), w);
+                }
+                else {
+                    hist.fill(varx->EvalInstance(i), w);
+                }
+            }
+        }
+    }
+
+    void Formulas::fill(TTree* tree, const std::vector<Long64_t>& entries, const std::vector<double>& weights,
+                        AutoHistogram& hist) {
+        for (std::size_t k = 0; k < entries.size(); ++k) {
+            if (jagged) {
+                if (!jagged->fillEntry(tree, entries[k], weights[k], hist)) {
+                    break;
+                }
+                continue;
+            }
+            if (tree->LoadTree(entries[k]) < 0) {
+                break;
+            }
+            const int ndata = manager->GetNdata();
+            for (int i = 0; i < ndata; ++i) {
+                if (vary) {
+                    hist.fill(varx->EvalInstance(i), vary->EvalInstance(i), weights[k]);
+                }
+                else {
+                    hist.fill(varx->EvalInstance(i), weights[k]);
+                }
+            }
+        }
+    }
+
+    void Formulas::record(TTree* tree, const std::vector<std::string>& leaves, std::vector<std::vector<double>>& values) {
+        for (std::size_t i = 0; i < leaves.size(); ++i) {
+            recorded.emplace_back(tree->GetLeaf(leaves[i].c_str()), values[i].data());
+        }
+    }
+
+    bool isScalarLeaf(TTree* tree, const std::string& name) {
+        TLeaf* leaf = tree->GetLeaf(name.c_str());
+        return leaf != nullptr && leaf->GetLeafCount() == nullptr && leaf->GetLenStatic() == 1
+               && dynamic_cast<TBranchElement*>(leaf->GetBranch()) == nullptr;
+    }
+
+    std::optional<ColumnPlan> planColumns(TTree* tree, const std::string& varexp, const std::string& selection) {
+        ColumnPlan plan;
+        if (const auto dims = split_varexp(varexp); dims.size() == 2) {
+            plan.vary = ColumnExpression::parse(dims[0]);
+            plan.varx = ColumnExpression::parse(dims[1]);
+            if (!plan.vary) {
+                return std::nullopt;
+            }
+        }
+        else {
+            plan.varx = ColumnExpression::parse(varexp);
+        }
+        if (!plan.varx) {
+            return std::nullopt;
+        }
+        if (!selection.empty()) {
+            plan.select = ColumnExpression::parse(selection);
+            if (!plan.select) {
+                return std::nullopt;
+            }
+        }
+        for (const auto* expr : {&plan.varx, &plan.vary, &plan.select}) {
+            if (!expr->has_value()) {
+                continue;
+            }
+            for (const auto& name : (*expr)->columns()) {
+                if (!isScalarLeaf(tree, name)) {
+                    return std::nullopt;
+                }
+                if (std::find(plan.leaves.begin(), plan.leaves.end(), name) == plan.leaves.end()) {
+                    plan.leaves.push_back(name);
+                }
+            }
+        }
+        return plan;
+    }
+
+    // Entries passing a cut, recorded in order while a draw reads the whole tree
+    struct CutRecorder {
+        void add(Long64_t entry, double weight) {
+            passed.add(entry);
+            unit = unit && weight == 1;
+        }
+
+        SelectionBitmap passed;
+        bool unit = true;
+        bool truncated = false; // The tree ended early, later entries are missing
+    };
+
+    // Cut of scalar leaves applied before the varexps are read. The passing
+    // entries of a cluster come from the cached bitmap, or from evaluating the
+    // cut on its own leaves, so the other branches are read for these only
+    class CutFilter {
+    public:
+        CutFilter(TTree* tree, const ColumnExpression& cut, SelectionCache::Entry cached, CutRecorder* recorder);
+
+        // Passing entries of [first, last) and their weights
+        void select(TTree* tree, Long64_t first, Long64_t last);
+        std::vector<Long64_t> entries;
+        std::vector<double> weights;
+
+    private:
+        // Cut values of entries into out, stops at the end of the tree
+        std::size_t evaluate(TTree* tree, const Long64_t* list, std::size_t n, double* out);
+
+        const ColumnExpression& m_cut;
+        SelectionCache::Entry m_cached;
+        CutRecorder* m_recorder;
+        std::vector<TLeaf*> m_leaves; // In the order of the cut columns
+        std::vector<std::vector<double>> m_values;
+        std::vector<const double*> m_data;
+        std::vector<Long64_t> m_candidates;
+        std::vector<double> m_cutValues;
+    };
+
+    CutFilter::CutFilter(TTree* tree, const ColumnExpression& cut, SelectionCache::Entry cached, CutRecorder* recorder)
+        : m_cut(cut), m_cached(std::move(cached)), m_recorder(recorder) {
+        for (const auto& name : cut.columns()) {
+            m_leaves.push_back(tree->GetLeaf(name.c_str()));
+            m_values.emplace_back(column_block);
+            m_data.push_back(m_values.back().data());
+        }
+    }
+
+    void CutFilter::select(TTree* tree, Long64_t first, Long64_t last) {
+        entries.clear();
+        weights.clear();
+        if (m_cached) {
+            m_cached->passed.entries(first, last, entries);
+            weights.resize(entries.size(), 1.0);
+            if (!m_cached->unitWeights) {
+                // Weights of the passing entries only
+                evaluate(tree, entries.data(), entries.size(), weights.data());
+            }
+            return;
+        }
+        m_candidates.resize(last - first);
+        std::iota(m_candidates.begin(), m_candidates.end(), first);
+        m_cutValues.resize(m_candidates.size());
+        const std::size_t n = evaluate(tree, m_candidates.data(), m_candidates.size(), m_cutValues.data());
+        if (m_recorder != nullptr && n < m_candidates.size()) {
+            m_recorder->truncated = true;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            if (m_cutValues[i] != 0) {
+                entries.push_back(m_candidates[i]);
+                weights.push_back(m_cutValues[i]);
+                if (m_recorder != nullptr) {
+                    m_recorder->add(m_candidates[i], m_cutValues[i]);
+                }
+            }
+        }
+    }
+
+    std::size_t CutFilter::evaluate(TTree* tree, const Long64_t* list, std::size_t n, double* out) {
+        for (std::size_t start = 0; start < n; start += column_block) {
+            const std::size_t block = std::min(column_block, n - start);
+            for (std::size_t i = 0; i < block; ++i) {
+                const Long64_t local = tree->LoadTree(list[start + i]);
+                if (local < 0) {
+                    m_cut.evaluate(m_data, 0, i, out + start);
+                    return start + i;
+                }
+                for (std::size_t l = 0; l < m_leaves.size(); ++l) {
+                    m_leaves[l]->GetBranch()->GetEntry(local);
+                    m_values[l][i] = m_leaves[l]->GetValue(0);
+                }
+            }
+            m_cut.evaluate(m_data, 0, block, out + start);
+        }
+        return n;
+    }
+
+    // Cache key of a cut, spaces and enclosing parentheses do not matter
+    std::string cutKey(const std::string& prefix, const std::string& cut) {
+        std::string key;
+        std::copy_if(cut.begin(), cut.end(), std::back_inserter(key), [](char c) { return !std::isspace(c); });
+        while (key.size() >= 2 && key.front() == '(' && key.back() == ')') {
+            int depth = 0;
+            std::size_t close = 0;
+            for (std::size_t i = 0; i < key.size() && close == 0; ++i) {
+                depth += key[i] == '(' ? 1 : key[i] == ')' ? -1 : 0;
+                close = depth == 0 ? i : 0;
+            }
+            if (close != key.size() - 1) {
+                break;
+            }
+            key = key.substr(1, key.size() - 2);
+        }
+        return prefix + key;
+    }
+
+    // Passing entries of a cut, also "a && b" from the bitmaps of a and b
+    // without reading the tree. nullptr if unknown
+    SelectionCache::Entry findCut(SelectionCache& cache, const std::string& prefix, const std::string& cut) {
+        if (auto entry = cache.find(cutKey(prefix, cut)); entry != nullptr) {
+            return entry;
+        }
+        const auto parts = split_conjunction(cut);
+        if (parts.empty()) {
+            return nullptr; // Only cached as a whole
+        }
+        CachedSelection combined;
+        for (std::size_t p = 0; p < parts.size(); ++p) {
+            const auto entry = cache.find(cutKey(prefix, parts[p]));
+            if (entry == nullptr) {
+                return nullptr;
+            }
+            combined.passed = p == 0 ? entry->passed : SelectionBitmap::intersect(combined.passed, entry->passed);
+        }
+        combined.unitWeights = true; // && is 0 or 1
+        return cache.insert(cutKey(prefix, cut), std::move(combined));
+    }
+
+    // Same result as the formulas, evaluated block by block from memory
+    // values[i] are the values of plan leaf i. Entries passing the selection
+    // are recorded if recorder is set, value index + offset is their entry
+    void fillFromColumns(const ColumnPlan& plan, const std::vector<const double*>& values,
+                         const std::vector<std::pair<Long64_t, Long64_t>>& ranges, AutoHistogram& hist,
+                         std::stop_token stop = {}, CutRecorder* recorder = nullptr, Long64_t offset = 0) {
+        auto inputs = [&](const ColumnExpression& expr) {
+            std::vector<const double*> data;
+            for (const auto& name : expr.columns()) {
+                const auto index = std::find(plan.leaves.begin(), plan.leaves.end(), name) - plan.leaves.begin();
+                data.push_back(values[index]);
+            }
+            return data;
+        };
+        const auto xdata = inputs(*plan.varx);
+        const auto ydata = plan.vary ? inputs(*plan.vary) : std::vector<const double*>();
+        const auto wdata = plan.select ? inputs(*plan.select) : std::vector<const double*>();
+
+        std::vector<double> x(column_block);
+        std::vector<double> y(column_block);
+        std::vector<double> w(column_block);
+        for (const auto& [first, last] : ranges) {
+            for (Long64_t start = first; start < last; start += column_block) {
+                if (stop.stop_requested()) {
+                    throw DrawEngine::Cancelled();
+                }
+                const std::size_t n = std::min<Long64_t>(column_block, last - start);
+                plan.varx->evaluate(xdata, start, n, x.data());
+                if (plan.vary) {
+                    plan.vary->evaluate(ydata, start, n, y.data());
+                }
+                if (plan.select) {
+                    plan.select->evaluate(wdata, start, n, w.data());
+                }
+                std::size_t selected = n;
+                if (plan.select) {
+                    // Keep selected entries only, the histogram takes whole blocks
+                    selected = 0;
+                    for (std::size_t i = 0; i < n; ++i) {
+                        if (w[i] != 0) {
+                            if (recorder != nullptr) {
+                                recorder->add(offset + start + i, w[i]);
+                            }
+                            x[selected] = x[i];
+                            y[selected] = y[i];
+                            w[selected] = w[i];
+                            selected++;
+                        }
+                    }
+                }
+                hist.fill(selected, x.data(), plan.vary ? y.data() : nullptr, plan.select ? w.data() : nullptr);
+            }
+        }
+    }
+
+    void Formulas::cacheBranches(TTree* tree) const {
+        std::vector<const TLeaf*> leaves;
+        if (jagged) {
+            leaves = {jagged->leaf, jagged->count};
+        }
+        for (const auto* formula : {varx.get(), vary.get(), select.get()}) {
+            for (int i = 0; formula != nullptr && i < formula->GetNcodes(); ++i) {
+                leaves.push_back(formula->GetLeaf(i));
+            }
+        }
+        for (const TLeaf* leaf : leaves) {
+            if (leaf != nullptr && leaf->GetBranch() != nullptr) {
+                tree->AddBranchToCache(leaf->GetBranch()->GetName(), true);
+            }
+        }
+    }
+
+    void Formulas::useColumns(TTree* tree, const ColumnPlan& plan) {
+        columns = &plan;
+        for (const auto& leaf : plan.leaves) {
+            columnLeaves.push_back(tree->GetLeaf(leaf.c_str()));
+        }
+    }
+
+    Long64_t Formulas::readColumns(TTree* tree, Long64_t first, Long64_t last, std::vector<std::vector<double>>& values) {
+        for (Long64_t entry = first; entry < last; ++entry) {
+            const Long64_t local = tree->LoadTree(entry);
+            if (local < 0) {
+                truncated = true;
+                return entry;
+            }
+            for (std::size_t l = 0; l < columnLeaves.size(); ++l) {
+                columnLeaves[l]->GetBranch()->GetEntry(local);
+                const double value = columnLeaves[l]->GetValue(0);
+                values[l][entry - first] = value;
+                if (!recorded.empty()) {
+                    recorded[l].second[entry] = value;
+                }
+            }
+        }
+        return last;
+    }
+
+    // Reads and decompresses leaf values on a background thread, while the
+    // caller evaluates and fills the chunk read before. Chunks are recycled,
+    // so memory stays at prefetch_chunks per pipeline
+    class ColumnPipeline {
+    public:
+        struct Chunk {
+            Long64_t first = 0;
+            Long64_t last = 0;
+            std::vector<std::vector<double>> values; // Per plan leaf
+            std::vector<const double*> data;
+        };
+
+        // next(range) gives the entries to read in order, false at the end.
+        // Called from the reader thread. io is locked while a chunk is read
+        ColumnPipeline(Formulas& formulas, TTree* tree, std::function<bool(std::pair<Long64_t, Long64_t>&)> next,
+                       std::recursive_mutex* io = nullptr);
+        ~ColumnPipeline();
+
+        // Next chunk in order, nullptr at the end. Rethrows errors of the reader
+        Chunk* pop();
+        // Chunk from pop is filled, it can be read into again
+        void release(Chunk* chunk);
+
+    private:
+        void read();
+
+        Formulas& m_formulas;
+        TTree* m_tree;
+        std::function<bool(std::pair<Long64_t, Long64_t>&)> m_next;
+        std::recursive_mutex* m_io;
+        std::vector<std::unique_ptr<Chunk>> m_chunks;
+        std::deque<Chunk*> m_free;
+        std::deque<Chunk*> m_ready;
+        bool m_done = false;
+        bool m_stop = false;
+        std::exception_ptr m_error;
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::thread m_reader; // Last, starts with everything above set up
+    };
+
+    ColumnPipeline::ColumnPipeline(Formulas& formulas, TTree* tree,
+                                   std::function<bool(std::pair<Long64_t, Long64_t>&)> next,
+                                   std::recursive_mutex* io)
+        : m_formulas(formulas), m_tree(tree), m_next(std::move(next)), m_io(io) {
+        for (int c = 0; c < prefetch_chunks; ++c) {
+            auto chunk = std::make_unique<Chunk>();
+            chunk->values.assign(formulas.columnLeaves.size(), std::vector<double>(prefetch_chunk));
+            for (const auto& column : chunk->values) {
+                chunk->data.push_back(column.data());
+            }
+            m_free.push_back(chunk.get());
+            m_chunks.push_back(std::move(chunk));
+        }
+        m_reader = std::thread(&ColumnPipeline::read, this);
+    }
+
+    ColumnPipeline::~ColumnPipeline() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_changed.notify_all();
+        m_reader.join();
+    }
+
+    ColumnPipeline::Chunk* ColumnPipeline::pop() {
+        std::unique_lock lock(m_mutex);
+        m_changed.wait(lock, [this]() { return !m_ready.empty() || m_done; });
+        if (!m_ready.empty()) {
+            Chunk* chunk = m_ready.front();
+            m_ready.pop_front();
+            return chunk;
+        }
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+        return nullptr;
+    }
+
+    void ColumnPipeline::release(Chunk* chunk) {
+        {
+            std::lock_guard lock(m_mutex);
+            m_free.push_back(chunk);
+        }
+        m_changed.notify_all();
+    }
+
+    void ColumnPipeline::read() {
+        try {
+            std::pair<Long64_t, Long64_t> range;
+            bool more = true;
+            while (more && m_next(range)) {
+                for (Long64_t start = range.first; more && start < range.second; start += prefetch_chunk) {
+                    Chunk* chunk = nullptr;
+                    {
+                        std::unique_lock lock(m_mutex);
+                        m_changed.wait(lock, [this]() { return m_stop || !m_free.empty(); });
+                        if (m_stop) {
+                            more = false;
+                            break;
+                        }
+                        chunk = m_free.front();
+                        m_free.pop_front();
+                    }
+                    const Long64_t end = std::min(start + prefetch_chunk, range.second);
+                    chunk->first = start;
+                    {
+                        const auto lock = lockTree(m_io);
+                        chunk->last = m_formulas.readColumns(m_tree, start, end, chunk->values);
+                    }
+                    more = chunk->last == end; // Short tree
+                    {
+                        std::lock_guard lock(m_mutex);
+                        m_ready.push_back(chunk);
+                        more = more && !m_stop;
+                    }
+                    m_changed.notify_all();
+                }
+            }
+        }
+        catch (...) {
+            std::lock_guard lock(m_mutex);
+            m_error = std::current_exception();
+        }
+        {
+            std::lock_guard lock(m_mutex);
+            m_done = true;
+        }
+        m_changed.notify_all();
+    }
+
+    // Calls fn(start, end) for each cluster overlapping [first, last)
+    template <typename Fn>
+    void forEachCluster(TTree* tree, Long64_t first, Long64_t last, Fn&& fn) {
+        auto clusters = tree->GetClusterIterator(first);
+        for (Long64_t start = clusters(); start < last; start = clusters()) {
+            fn(std::max(start, first), std::min(clusters.GetNextEntry(), last));
+        }
+    }
+
+    std::string treePath(TTree* tree) {
+        // Path inside the file, GetPath() is "file.root:/dir"
+        std::string path = tree->GetDirectory()->GetPath();
+        if (const auto pos = path.find(":/"); pos != std::string::npos) {
+            path = path.substr(pos + 2);
+        }
+        if (!path.empty()) {
+            path += '/';
+        }
+        return path + tree->GetName();
+    }
+
+    TTree* openTree(const std::string& filename, const std::string& path, std::unique_ptr<TFile>& file) {
+        file.reset(TFile::Open(filename.c_str(), "READ"));
+        return file ? dynamic_cast<TTree*>(file->Get(path.c_str())) : nullptr;
+    }
+
+    // Sums of one leaf relative to its first value, which keeps the sum of
+    // squares precise for values far from zero
+    struct LeafStats {
+        void add(double x) {
+            if (!is_finite(x)) {
+                nonfinite++;
+                return;
+            }
+            if (n == 0) {
+                shift = x;
+            }
+            n++;
+            zeros += x == 0;
+            min = std::min(min, x);
+            max = std::max(max, x);
+            const double d = x - shift;
+            sum += d;
+            sum2 += d * d;
+        }
+        DrawEngine::LeafSummary summary() const {
+            DrawEngine::LeafSummary summary;
+            summary.entries = n;
+            summary.nonfinite = nonfinite;
+            summary.zeros = zeros;
+            summary.min = min;
+            summary.max = max;
+            if (n > 0) {
+                summary.mean = shift + sum / n;
+                summary.m2 = std::max(0.0, sum2 - sum * sum / n);
+            }
+            return summary;
+        }
+
+        Long64_t n = 0;
+        Long64_t nonfinite = 0;
+        Long64_t zeros = 0;
+        double min = std::numeric_limits<double>::infinity();
+        double max = -std::numeric_limits<double>::infinity();
+        double shift = 0;
+        double sum = 0;
+        double sum2 = 0;
+    };
+
+    template <typename T>
+    void accumulateTyped(const void* data, int n, LeafStats& stats) {
+        const T* values = static_cast<const T*>(data);
+        for (int i = 0; i < n; ++i) {
+            stats.add(static_cast<double>(values[i]));
+        }
+    }
+
+    // Numeric leaves of a tree, objects and strings are skipped
+    struct LeafScan {
+        explicit LeafScan(TTree* tree);
+
+        // Adds the values of entries [first, last) to stats[leaf]
+        void scan(TTree* tree, Long64_t first, Long64_t last, std::vector<LeafStats>& stats) const;
+
+        std::vector<TLeaf*> leaves;
+        std::vector<void (*)(const void*, int, LeafStats&)> accumulate;
+        std::vector<TBranch*> branches; // Holding the leaves, each read once per entry
+        std::vector<std::string> skipped; // Full names of the leaves that are not read
+    };
+
+    LeafScan::LeafScan(TTree* tree) {
+        static const std::pair<const char*, void (*)(const void*, int, LeafStats&)> types[] = {
+            {"Float_t", accumulateTyped<Float_t>},   {"Double_t", accumulateTyped<Double_t>},
+            {"Int_t", accumulateTyped<Int_t>},       {"UInt_t", accumulateTyped<UInt_t>},
+            {"Long64_t", accumulateTyped<Long64_t>}, {"ULong64_t", accumulateTyped<ULong64_t>},
+            {"Short_t", accumulateTyped<Short_t>},   {"UShort_t", accumulateTyped<UShort_t>},
+            {"Char_t", accumulateTyped<Char_t>},     {"UChar_t", accumulateTyped<UChar_t>},
+            {"Bool_t", accumulateTyped<Bool_t>},
+        };
+        auto addBranch = [this](TBranch* branch) {
+            if (std::find(branches.begin(), branches.end(), branch) == branches.end()) {
+                branches.push_back(branch);
+            }
+        };
+        for (auto* object : *tree->GetListOfLeaves()) {
+            auto* leaf = static_cast<TLeaf*>(object);
+            const auto type = std::find_if(std::begin(types), std::end(types), [leaf](const auto& known) {
+                return std::strcmp(leaf->GetTypeName(), known.first) == 0;
+            });
+            if (dynamic_cast<TBranchElement*>(leaf->GetBranch()) != nullptr || dynamic_cast<TLeafC*>(leaf) != nullptr
+                || type == std::end(types)) {
+                skipped.emplace_back(leaf->GetFullName());
+                continue;
+            }
+            // Lengths of arrays are read first
+            if (leaf->GetLeafCount() != nullptr) {
+                addBranch(leaf->GetLeafCount()->GetBranch());
+            }
+            addBranch(leaf->GetBranch());
+            leaves.push_back(leaf);
+            accumulate.push_back(type->second);
+        }
+    }
+
+    void LeafScan::scan(TTree* tree, Long64_t first, Long64_t last, std::vector<LeafStats>& stats) const {
+        for (Long64_t entry = first; entry < last; ++entry) {
+            const Long64_t local = tree->LoadTree(entry);
+            if (local < 0) {
+                break;
+            }
+            for (TBranch* branch : branches) {
+                branch->GetEntry(local);
+            }
+            for (std::size_t l = 0; l < leaves.size(); ++l) {
+                accumulate[l](leaves[l]->GetValuePointer(), leaves[l]->GetLen(), stats[l]);
+            }
+        }
+    }
+}
+
+AutoHistogram DrawEngine::draw(TTree* tree, const std::string& varexp, const std::string& selection,
+                               const std::vector<double>& limits, Long64_t nentries, Long64_t firstentry,
+                               std::stop_token stop, const Progress& progress, std::recursive_mutex* io) const {
+    return std::move(draw(tree, std::vector{varexp}, selection, limits, nentries, firstentry, stop, progress, io)[0]);
+}
+
+std::vector<AutoHistogram> DrawEngine::draw(TTree* tree, const std::vector<std::string>& varexps,
+                                            const std::string& selection, const std::vector<double>& limits,
+                                            Long64_t nentries, Long64_t firstentry, std::stop_token stop,
+                                            const Progress& progress, std::recursive_mutex* io) const {
+    const Long64_t lastentry = std::min(tree->GetEntries(), firstentry + std::min(nentries, tree->GetEntries()));
+    return fill(tree, varexps, selection, limits, {{firstentry, lastentry}}, stop, progress, io);
+}
+
+AutoHistogram DrawEngine::sample(TTree* tree, const std::string& varexp, const std::string& selection,
+                                 const std::vector<double>& limits, Long64_t nentries, Long64_t firstentry,
+                                 double fraction, std::stop_token stop, const Progress& progress,
+                                 std::recursive_mutex* io) const {
+    return std::move(sample(tree, std::vector{varexp}, selection, limits, nentries, firstentry, fraction, stop,
+                            progress, io)[0]);
+}
+
+std::vector<AutoHistogram> DrawEngine::sample(TTree* tree, const std::vector<std::string>& varexps,
+                                              const std::string& selection, const std::vector<double>& limits,
+                                              Long64_t nentries, Long64_t firstentry, double fraction,
+                                              std::stop_token stop, const Progress& progress,
+                                              std::recursive_mutex* io) const {
+    const Long64_t lastentry = std::min(tree->GetEntries(), firstentry + std::min(nentries, tree->GetEntries()));
+    return fill(tree, varexps, selection, limits, sampleClusters(tree, firstentry, lastentry, fraction), stop,
+                progress, io);
+}
+
+std::vector<AutoHistogram> DrawEngine::fill(TTree* tree, const std::vector<std::string>& varexps,
+                                            const std::string& selection, const std::vector<double>& limits,
+                                            const std::vector<EntryRange>& ranges, std::stop_token stop,
+                                            const Progress& progress, std::recursive_mutex* io) const {
+    using Clock = std::chrono::steady_clock;
+    Long64_t total = 0;
+    for (const auto& [first, last] : ranges) {
+        total += last - first;
+    }
+    const Long64_t entries = tree->GetEntries();
+    const bool wholeTree = total == entries && ranges.size() == 1;
+    const std::string treePrefix = tree->GetCurrentFile() != nullptr
+                                   ? std::string(tree->GetCurrentFile()->GetName()) + ':' + treePath(tree) + ':'
+                                   : std::string();
+
+    // Entries passing a cut of scalar leaves are kept as bitmap. Later draws
+    // with the same cut, or with && of known cuts, only read those entries
+    std::optional<ColumnExpression> cut;
+    SelectionCache::Entry cutCached;
+    if (!selection.empty() && m_selectionCache != nullptr && !treePrefix.empty()) {
+        cut = ColumnExpression::parse(selection);
+        if (cut && std::all_of(cut->columns().begin(), cut->columns().end(),
+                               [tree](const std::string& name) { return isScalarLeaf(tree, name); })) {
+            cutCached = findCut(*m_selectionCache, treePrefix, selection);
+        }
+        else {
+            cut.reset();
+        }
+    }
+    const bool recordCut = cut && cutCached == nullptr && wholeTree;
+    std::vector<CutRecorder> recorders(1);
+    auto keepCut = [&]() {
+        if (!recordCut) {
+            return;
+        }
+        CachedSelection passed;
+        for (const auto& recorder : recorders) {
+            if (recorder.truncated) {
+                return; // Would be taken for the passing entries of the whole tree
+            }
+            passed.passed = SelectionBitmap::unite(passed.passed, recorder.passed);
+            passed.unitWeights = passed.unitWeights && recorder.unit;
+        }
+        m_selectionCache->insert(cutKey(treePrefix, selection), std::move(passed));
+    };
+
+    // Leaves read before are evaluated from memory, otherwise they are
+    // recorded while filling if the whole tree is read
+    const bool cacheColumns = m_columnCache != nullptr && !treePrefix.empty();
+    std::optional<ColumnPlan> plan;
+    if (varexps.size() == 1) {
+        plan = planColumns(tree, varexps[0], selection);
+    }
+    std::vector<ColumnCache::Entry> cachedColumns;
+    if (plan && cacheColumns) {
+        for (const auto& leaf : plan->leaves) {
+            if (auto column = m_columnCache->find(treePrefix + leaf); column != nullptr) {
+                cachedColumns.push_back(std::move(column));
+            }
+        }
+    }
+    const bool fromColumns = plan && cachedColumns.size() == plan->leaves.size();
+    // The cut is applied first unless everything is in memory anyway or the
+    // columns of a large scalar draw are read for the first time. Both
+    // record the cut as well
+    const bool filtered = cut && !fromColumns && (cutCached != nullptr || !plan || total < min_parallel_entries);
+    if (filtered) {
+        plan.reset();
+    }
+    const std::string formulaSelection = filtered ? std::string() : selection;
+
+    // Formulas and histogram per expression, all filled in the same pass
+    std::vector<Formulas> formulas;
+    std::vector<AutoHistogram> hists;
+    formulas.reserve(varexps.size());
+    {
+        const auto lock = lockTree(io);
+        for (const auto& varexp : varexps) {
+            formulas.emplace_back(tree, varexp, formulaSelection);
+            hists.push_back(makeHistogram(formulas.back().vary != nullptr, limits));
+        }
+    }
+    // Large draws of scalar leaves are read on a background thread and
+    // evaluated in blocks, by native kernels if they compile
+    const bool pipelined = plan && total >= min_parallel_entries;
+    if (pipelined && m_kernels != nullptr) {
+        for (auto* expr : {&plan->varx, &plan->vary, &plan->select}) {
+            if (expr->has_value()) {
+                m_kernels->compile(**expr);
+            }
+        }
+    }
+    if (fromColumns) {
+        std::vector<const double*> values;
+        for (const auto& column : cachedColumns) {
+            values.push_back(column->data());
+        }
+        fillFromColumns(*plan, values, ranges, hists[0], stop, recordCut ? &recorders[0] : nullptr);
+        keepCut();
+        return hists;
+    }
+    if (pipelined) {
+        formulas[0].useColumns(tree, *plan);
+    }
+    const bool recording = plan && cacheColumns && wholeTree &&
+                           m_columnCache->fits(entries * sizeof(double) * plan->leaves.size());
+    std::vector<std::vector<double>> recorded;
+    if (recording) {
+        recorded.assign(plan->leaves.size(), std::vector<double>(entries));
+        formulas[0].record(tree, plan->leaves, recorded);
+    }
+    // Set by threads whose copy ended early, their part of the columns was not read
+    std::atomic<bool> recordingTruncated = false;
+    auto keepColumns = [&]() {
+        if (formulas[0].truncated || recordingTruncated) {
+            return; // A column with gaps would be taken for the values of the tree
+        }
+        for (std::size_t i = 0; recording && i < recorded.size(); ++i) {
+            m_columnCache->insert(treePrefix + plan->leaves[i], std::move(recorded[i]));
+        }
+    };
+    auto fillSerial = [&]() {
+        auto reported = Clock::now();
+        Long64_t done = 0;
+        auto report = [&](Long64_t count) {
+            done += count;
+            if (progress && Clock::now() - reported >= m_progressInterval) {
+                progress(hists, done, total);
+                reported = Clock::now();
+            }
+        };
+        if (pipelined) {
+            std::size_t next = 0;
+            ColumnPipeline pipeline(formulas[0], tree, [&](std::pair<Long64_t, Long64_t>& range) {
+                if (next == ranges.size()) {
+                    return false;
+                }
+                range = ranges[next++];
+                return true;
+            }, io);
+            while (auto* chunk = pipeline.pop()) {
+                fillFromColumns(*plan, chunk->data, {{0, chunk->last - chunk->first}}, hists[0], stop,
+                                recordCut ? &recorders[0] : nullptr, chunk->first);
+                report(chunk->last - chunk->first);
+                pipeline.release(chunk);
+            }
+            recorders[0].truncated = recorders[0].truncated || formulas[0].truncated;
+            return;
+        }
+        std::optional<CutFilter> filter;
+        if (filtered) {
+            filter.emplace(tree, *cut, cutCached, recordCut ? &recorders[0] : nullptr);
+        }
+        {
+            const auto lock = lockTree(io);
+            for (const auto& formula : formulas) {
+                formula.cacheBranches(tree);
+            }
+        }
+        for (const auto& [first, last] : ranges) {
+            forEachCluster(tree, first, last, [&](Long64_t start, Long64_t end) {
+                if (stop.stop_requested()) {
+                    throw Cancelled();
+                }
+                {
+                    const auto lock = lockTree(io);
+                    if (filter) {
+                        filter->select(tree, start, end);
+                        for (std::size_t p = 0; p < formulas.size(); ++p) {
+                            formulas[p].fill(tree, filter->entries, filter->weights, hists[p]);
+                        }
+                    }
+                    else {
+                        // The expressions after the first find the cluster in the tree cache, see cacheBranches
+                        for (std::size_t p = 0; p < formulas.size(); ++p) {
+                            formulas[p].fill(tree, start, end, hists[p]);
+                        }
+                    }
+                }
+                report(end - start);
+            });
+        }
+    };
+
+    const int nthreads = m_threads > 0 ? m_threads : std::max(1u, std::thread::hardware_concurrency());
+    if (nthreads == 1 || total < min_parallel_entries || tree->GetCurrentFile() == nullptr) {
+        fillSerial();
+        keepColumns();
+        keepCut();
+        return hists;
+    }
+
+    // Every thread reads its own copy of the tree from the file
+    const auto tasks = clusterTasks(tree, ranges, nthreads * tasks_per_thread);
+    const std::string filename = tree->GetCurrentFile()->GetName();
+    const std::string path = treePath(tree);
+    std::vector<std::vector<AutoHistogram>> partial(nthreads, hists);
+    // Partial histograms are locked per cluster, so progress can be merged
+    std::vector<std::mutex> partialMutex(nthreads);
+    std::atomic<std::size_t> nextTask = 0;
+    std::atomic<Long64_t> processed = 0;
+    std::atomic<bool> failed = false;
+    int running = nthreads;
+    std::mutex runningMutex;
+    std::condition_variable finished;
+    std::vector<std::thread> workers;
+    recorders.resize(nthreads);
+    for (int t = 0; t < nthreads; ++t) {
+        workers.emplace_back([&, t]() {
+            try {
+                std::unique_ptr<TFile> file;
+                TTree* copy = openTree(filename, path, file);
+                if (copy == nullptr) {
+                    failed = true;
+                }
+                else {
+                    std::vector<Formulas> own;
+                    own.reserve(varexps.size());
+                    for (const auto& varexp : varexps) {
+                        own.emplace_back(copy, varexp, formulaSelection);
+                        own.back().cacheBranches(copy);
+                    }
+                    std::optional<CutFilter> filter;
+                    if (filtered) {
+                        filter.emplace(copy, *cut, cutCached, recordCut ? &recorders[t] : nullptr);
+                    }
+                    if (recording) {
+                        own[0].record(copy, plan->leaves, recorded);
+                    }
+                    if (pipelined) {
+                        own[0].useColumns(copy, *plan);
+                        ColumnPipeline pipeline(own[0], copy, [&](std::pair<Long64_t, Long64_t>& range) {
+                            const std::size_t task = nextTask++;
+                            if (task >= tasks.size() || failed || stop.stop_requested()) {
+                                return false;
+                            }
+                            range = tasks[task];
+                            return true;
+                        });
+                        while (auto* chunk = pipeline.pop()) {
+                            if (stop.stop_requested()) {
+                                break;
+                            }
+                            std::lock_guard lock(partialMutex[t]);
+                            fillFromColumns(*plan, chunk->data, {{0, chunk->last - chunk->first}}, partial[t][0], {},
+                                            recordCut ? &recorders[t] : nullptr, chunk->first);
+                            processed += chunk->last - chunk->first;
+                            pipeline.release(chunk);
+                        }
+                    }
+                    else {
+                        for (std::size_t task = nextTask++; task < tasks.size() && !failed && !stop.stop_requested();
+                             task = nextTask++) {
+                            forEachCluster(copy, tasks[task].first, tasks[task].second, [&](Long64_t start, Long64_t end) {
+                                if (stop.stop_requested()) {
+                                    return;
+                                }
+                                if (filter) {
+                                    // Cut leaves are read outside the lock, progress merges wait less
+                                    filter->select(copy, start, end);
+                                }
+                                std::lock_guard lock(partialMutex[t]);
+                                for (std::size_t p = 0; p < own.size(); ++p) {
+                                    if (filter) {
+                                        own[p].fill(copy, filter->entries, filter->weights, partial[t][p]);
+                                    }
+                                    else {
+                                        own[p].fill(copy, start, end, partial[t][p]);
+                                    }
+                                }
+                                processed += end - start;
+                            });
+                        }
+                    }
+                    if (own[0].truncated) {
+                        recordingTruncated = true;
+                        recorders[t].truncated = true;
+                    }
+                }
+            }
+            catch (...) {
+                failed = true;
+            }
+            std::lock_guard lock(runningMutex);
+            --running;
+            finished.notify_one();
+        });
+    }
+    {
+        std::unique_lock lock(runningMutex);
+        while (!finished.wait_for(lock, m_progressInterval, [&]() { return running == 0; })) {
+            if (!progress || failed || stop.stop_requested()) {
+                continue;
+            }
+            lock.unlock();
+            std::vector<AutoHistogram> snapshot = hists;
+            for (int t = 0; t < nthreads; ++t) {
+                std::lock_guard partialLock(partialMutex[t]);
+                for (std::size_t p = 0; p < snapshot.size(); ++p) {
+                    snapshot[p].merge(partial[t][p]);
+                }
+            }
+            progress(snapshot, processed, total);
+            lock.lock();
+        }
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if (stop.stop_requested()) {
+        throw Cancelled();
+    }
+    if (failed) {
+        // E.g. file not readable from several threads, do it here instead
+        recorders.assign(1, CutRecorder());
+        recordingTruncated = false;
+        fillSerial();
+        keepColumns();
+        keepCut();
+        return hists;
+    }
+    for (const auto& part : partial) {
+        for (std::size_t p = 0; p < hists.size(); ++p) {
+            hists[p].merge(part[p]);
+        }
+    }
+    keepColumns();
+    keepCut();
+    return hists;
+}
+
+std::vector<DrawEngine::LeafSummary> DrawEngine::describe(TTree* tree, std::stop_token stop,
+                                                          const std::function<void(Long64_t, Long64_t)>& progress,
+                                                          std::recursive_mutex* io) const {
+    using Clock = std::chrono::steady_clock;
+    std::optional<LeafScan> found;
+    {
+        const auto lock = lockTree(io);
+        found.emplace(tree);
+    }
+    const LeafScan& scan = *found;
+    const std::size_t nleaves = scan.leaves.size();
+    const Long64_t total = tree->GetEntries();
+    auto summarize = [&](const std::vector<std::vector<LeafStats>>& parts) {
+        std::vector<LeafSummary> summaries(nleaves);
+        for (std::size_t l = 0; l < nleaves; ++l) {
+            summaries[l].name = scan.leaves[l]->GetFullName();
+            for (const auto& part : parts) {
+                summaries[l].merge(part[l].summary());
+            }
+        }
+        for (const auto& name : scan.skipped) {
+            summaries.emplace_back().name = name;
+            summaries.back().summarized = false;
+        }
+        return summaries;
+    };
+    auto describeSerial = [&]() {
+        std::vector<LeafStats> stats(nleaves);
+        auto reported = Clock::now();
+        forEachCluster(tree, 0, total, [&](Long64_t start, Long64_t end) {
+            if (stop.stop_requested()) {
+                throw Cancelled();
+            }
+            {
+                const auto lock = lockTree(io);
+                scan.scan(tree, start, end, stats);
+            }
+            if (progress && Clock::now() - reported >= m_progressInterval) {
+                progress(end, total);
+                reported = Clock::now();
+            }
+        });
+        return summarize({stats});
+    };
+
+    const int nthreads = m_threads > 0 ? m_threads : std::max(1u, std::thread::hardware_concurrency());
+    if (nthreads == 1 || total < min_parallel_entries || tree->GetCurrentFile() == nullptr) {
+        return describeSerial();
+    }
+
+    // Every thread reads all leaves of its clusters from its own copy of the tree
+    const auto tasks = clusterTasks(tree, {{0, total}}, nthreads * tasks_per_thread);
+    const std::string filename = tree->GetCurrentFile()->GetName();
+    const std::string path = treePath(tree);
+    std::vector<std::vector<LeafStats>> parts(nthreads, std::vector<LeafStats>(nleaves));
+    std::atomic<std::size_t> nextTask = 0;
+    std::atomic<Long64_t> processed = 0;
+    std::atomic<bool> failed = false;
+    int running = nthreads;
+    std::mutex runningMutex;
+    std::condition_variable finished;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < nthreads; ++t) {
+        workers.emplace_back([&, t]() {
+            try {
+                std::unique_ptr<TFile> file;
+                TTree* copy = openTree(filename, path, file);
+                const std::optional<LeafScan> own = copy != nullptr ? std::optional<LeafScan>(copy) : std::nullopt;
+                if (!own || own->leaves.size() != nleaves) {
+                    failed = true;
+                }
+                else {
+                    for (std::size_t task = nextTask++; task < tasks.size() && !failed && !stop.stop_requested();
+                         task = nextTask++) {
+                        forEachCluster(copy, tasks[task].first, tasks[task].second, [&](Long64_t start, Long64_t end) {
+                            if (stop.stop_requested()) {
+                                return;
+                            }
+                            own->scan(copy, start, end, parts[t]);
+                            processed += end - start;
+                        });
+                    }
+                }
+            }
+            catch (...) {
+                failed = true;
+            }
+            std::lock_guard lock(runningMutex);
+            --running;
+            finished.notify_one();
+        });
+    }
+    {
+        std::unique_lock lock(runningMutex);
+        while (!finished.wait_for(lock, m_progressInterval, [&]() { return running == 0; })) {
+            if (progress && !failed && !stop.stop_requested()) {
+                progress(processed, total);
+            }
+        }
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if (stop.stop_requested()) {
+        throw Cancelled();
+    }
+    if (failed) {
+        return describeSerial();
+    }
+    return summarize(parts);
+}
+
+double DrawEngine::LeafSummary::rms() const {
+    return entries > 0 ? std::sqrt(m2 / entries) : 0.0;
+}
+
+double DrawEngine::LeafSummary::zeroFraction() const {
+    const Long64_t values = entries + nonfinite;
+    return values > 0 ? static_cast<double>(zeros) / values : 0.0;
+}
+
+void DrawEngine::LeafSummary::merge(const LeafSummary& other) {
+    // Pairwise update of mean and squared deviations (Chan et al.)
+    if (other.entries > 0) {
+        const double n = static_cast<double>(entries) + other.entries;
+        const double delta = other.mean - mean;
+        mean += delta * other.entries / n;
+        m2 += other.m2 + delta * delta * entries * (other.entries / n);
+    }
+    entries += other.entries;
+    nonfinite += other.nonfinite;
+    zeros += other.zeros;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
+
+TTree* DrawEngine::openCopy(TTree* tree, std::unique_ptr<TFile>& file) {
+    if (tree->GetCurrentFile() == nullptr) {
+        return nullptr;
+    }
+    return openTree(tree->GetCurrentFile()->GetName(), treePath(tree), file);
+}
+
+std::vector<DrawEngine::EntryRange> DrawEngine::clusterTasks(TTree* tree, const std::vector<EntryRange>& ranges, int ntasks) {
+    Long64_t total = 0;
+    for (const auto& [first, last] : ranges) {
+        total += last - first;
+    }
+    const Long64_t target = std::max<Long64_t>(total / ntasks, 1);
+    std::vector<EntryRange> tasks;
+    for (const auto& [first, last] : ranges) {
+        Long64_t taskStart = first;
+        forEachCluster(tree, first, last, [&](Long64_t, Long64_t end) {
+            if (end - taskStart >= target) {
+                tasks.emplace_back(taskStart, end);
+                taskStart = end;
+            }
+        });
+        if (taskStart < last) {
+            tasks.emplace_back(taskStart, last);
+        }
+    }
+    return tasks;
+}
+
+std::vector<DrawEngine::EntryRange> DrawEngine::sampleClusters(TTree* tree, Long64_t first, Long64_t last, double fraction) {
+    // One cluster at a random position in every group of 1/fraction clusters,
+    // fixed seed so the same preview is drawn again
+    const int stride = std::max(1, static_cast<int>(std::lround(1.0 / fraction)));
+    std::minstd_rand random(stride);
+    std::vector<EntryRange> clusters;
+    std::vector<EntryRange> sampled;
+    forEachCluster(tree, first, last, [&](Long64_t start, Long64_t end) {
+        clusters.emplace_back(start, end);
+        if (static_cast<int>(clusters.size()) == stride) {
+            sampled.push_back(clusters[random() % stride]);
+            clusters.clear();
+        }
+    });
+    if (!clusters.empty()) {
+        sampled.push_back(clusters[random() % clusters.size()]);
+    }
+    return sampled;
+}
+
+AutoHistogram DrawEngine::makeHistogram(bool is2d, const std::vector<double>& limits) const {
+    AutoHistogram hist(is2d ? 2 : 1, m_bufferSize);
+    for (std::size_t axis = 0; 2 * axis + 1 < limits.size(); ++axis) {
+        hist.setRange(axis, limits[2 * axis], limits[2 * axis + 1]);
+    }
+    return hist;
+}
+
+void DrawEngine::setBufferSize(std::size_t size) {
+    m_bufferSize = std::max<std::size_t>(size, 1);
+}
+
+std::size_t DrawEngine::bufferSize() const {
+    return m_bufferSize;
+}
+
+void DrawEngine::setThreads(unsigned threads) {
+    m_threads = threads;
+}
+
+void DrawEngine::setColumnCache(ColumnCache* cache) {
+    m_columnCache = cache;
+}
+
+void DrawEngine::setSelectionCache(SelectionCache* cache) {
+    m_selectionCache = cache;
+}
+
+void DrawEngine::setKernelCompiler(KernelCompiler* compiler) {
+    m_kernels = compiler;
+}
+
+void DrawEngine::setProgressInterval(std::chrono::milliseconds interval) {
+    m_progressInterval = interval;
+}
@@ -0,0 +1,52 @@
+#include "FenwickTree.h"
+
+void FenwickTree::assign(const std::vector<int>& values) {
+    m_size = values.size();
+    m_tree.assign(m_size + 1, 0);
+    for (int i = 1; i <= m_size; ++i) {
+        m_tree[i] += values[i - 1];
+        if (int parent = i + (i & -i); parent <= m_size) {
+            m_tree[parent] += m_tree[i];
+        }
+    }
+    m_highBit = 1;
+    while (m_highBit * 2 <= m_size) {
+        m_highBit *= 2;
+    }
+}
+
+void FenwickTree::add(int i, int delta) {
+    for (++i; i <= m_size; i += i & -i) {
+        m_tree[i] += delta;
+    }
+}
+
+int FenwickTree::prefix(int i) const {
+    int sum = 0;
+    for (; i > 0; i -= i & -i) {
+        sum += m_tree[i];
+    }
+    return sum;
+}
+
+int FenwickTree::total() const {
+    return prefix(m_size);
+}
+
+int FenwickTree::size() const {
+    return m_size;
+}
+
+int FenwickTree::find(int k) const {
+    if (k < 0) {
+        return m_size;
+    }
+    int pos = 0;
+    for (int step = m_highBit; step > 0; step /= 2) {
+        if (pos + step <= m_size && m_tree[pos + step] <= k) {
+            pos += step;
+            k -= m_tree[pos];
+        }
+    }
+    return pos;
+}
@@ -0,0 +1,16 @@
+#include "HistogramCache.h"
+
+std::size_t std::hash<HistogramKey>::operator()(const HistogramKey& key) const {
+    std::size_t seed = std::hash<const void*>{}(key.tree);
+    const auto combine = [&seed](std::size_t value) { seed ^= value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2); };
+    combine(std::hash<std::string>{}(key.varexp));
+    combine(std::hash<std::string>{}(key.selection));
+    combine(std::hash<Long64_t>{}(key.nentries));
+    combine(std::hash<Long64_t>{}(key.firstentry));
+    combine(std::hash<std::size_t>{}(key.bufferSize));
+    combine(std::hash<double>{}(key.sample));
+    for (double limit : key.limits) {
+        combine(std::hash<double>{}(limit));
+    }
+    return seed;
+}
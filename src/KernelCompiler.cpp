@@ -0,0 +1,28 @@
+#include "KernelCompiler.h"
+#include "TInterpreter.h"
+#include <cstdint>
+
+bool KernelCompiler::compile(ColumnExpression& expr) {
+    const std::string source = expr.source();
+    std::lock_guard lock(m_mutex);
+    auto it = m_kernels.find(source);
+    if (it == m_kernels.end()) {
+        const std::string name = "tbrowser_kernel_" + std::to_string(m_kernels.size());
+        const std::string code =
+            "#include <cmath>\n"
+            "#include <cstddef>\n"
+            "extern \"C\" void " + name + "(const double* const* c, std::size_t first, std::size_t n, double* out) {\n"
+            "    for (std::size_t i = first; i < first + n; ++i) {\n"
+            "        out[i - first] = " + source + ";\n"
+            "    }\n"
+            "}\n";
+        ColumnExpression::Kernel kernel = nullptr;
+        if (gInterpreter->Declare(code.c_str())) {
+            const auto address = gInterpreter->Calc(("(long)&" + name).c_str());
+            kernel = reinterpret_cast<ColumnExpression::Kernel>(static_cast<std::intptr_t>(address));
+        }
+        it = m_kernels.emplace(source, kernel).first;
+    }
+    expr.setKernel(it->second);
+    return it->second != nullptr;
+}
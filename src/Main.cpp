@@ -2,6 +2,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <fcntl.h>
+#include <sys/select.h>
 #include <iostream>
 #include <filesystem>
 #include <string>
@@ -10,6 +11,7 @@
 #include <ncurses.h>
 #include "Browser.h"
 #include <TError.h>
+#include <TROOT.h>
 
 /*
 🬂🬨🬂🬀🬕🬂🬓🬞🬞🬏 🬞🬭🬏🬞  🬞 🬭🬭  🬭🬭 🬞🬞🬏 
@@ -27,7 +29,7 @@
 // - [ ] TH1 plotting
 // - [ ] TH2 plotting
 // - [x] Tab completion
-// - [ ] Histogram buffer (quick redraw)
+// - [x] Histogram buffer (quick redraw)
 // - [x] Menu resize
 // - [x] Make log toggle command dependent
 // - [x] Help window <?>
@@ -48,9 +50,13 @@ extern bool resize_flag;
 
 int resize_fd[2]; // PIPE
 
+constexpr int idle_timeout_us = 20000;
+
 int main(int argc, char* argv[]) {
     // Silence ROOT messages including errors
     gErrorIgnoreLevel = kFatal;
+    // File is indexed in a background thread
+    ROOT::EnableThreadSafety();
 
     // Read argument
     std::string filename;
@@ -81,6 +87,13 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 #endif
+    // Make pipe, also used by background work to wake up the main loop
+    if (pipe(resize_fd) == -1) {
+        perror("pipe error");
+        return EXIT_FAILURE;
+    }
+    fcntl(resize_fd[0], F_SETFL, O_NONBLOCK);
+
     // Initial window setup
     FileBrowser browser;
 
@@ -93,15 +106,9 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
-    // Make pipe
-    if (pipe(resize_fd) == -1) {
-        perror("pipe error");
-        return EXIT_FAILURE;
-    }
-    fcntl(resize_fd[0], F_SETFL, O_NONBLOCK);
     signal(SIGWINCH, [](int) { 
         resize_flag = true; 
-        write(resize_fd[1], "R", 1); // Notify select
+        write(resize_fd[1], &notify_resize, 1); // Notify select
     });
 
     MEVENT mouse_event;
@@ -114,14 +121,28 @@ int main(int argc, char* argv[]) {
         FD_SET(fileno(stdin), &fds);
         FD_SET(resize_fd[0], &fds);
         
-        // Wait for input or signal
-        select(resize_fd[0] + 1, &fds, NULL, NULL, NULL);
+        // Wait for input or signal, do background work if nothing happens
+        struct timeval idle = {0, idle_timeout_us};
+        if (select(resize_fd[0] + 1, &fds, NULL, NULL, browser.hasIdleWork() ? &idle : NULL) == 0) {
+            browser.handleIdle();
+            continue;
+        }
 
         if (FD_ISSET(resize_fd[0], &fds)) {
             char buf = 0;
             read(resize_fd[0], &buf, 1);
-            // Handle resize
-            browser.handleResize();
+            switch (buf) {
+                case notify_index:
+                    browser.handleIndexUpdate();
+                    break;
+                case notify_draw:
+                    browser.handleDrawUpdate();
+                    break;
+                default:
+                    // Handle resize
+                    browser.handleResize();
+                    break;
+            }
         }
         if (FD_ISSET(fileno(stdin), &fds)) {
             int input = getch();
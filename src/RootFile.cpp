@@ -1,15 +1,98 @@
 #include "RootFile.h"
 #include "TKey.h"
+#include "TClass.h"
 #include "definitions.h"
+#include <algorithm>
 #include <memory>
+#include <deque>
+#include <fstream>
+#include <nlohmann/json.hpp>
 
+using JSON = nlohmann::json;
 
-RootFile::Node::Node() : type(NodeType::UNKNOWN) { }
+// Bump when the cache layout changes
+static constexpr int index_cache_version = 2;
 
-RootFile::Node::Node(NodeType nt, int idx, Node* mot, int nest) 
-    : type(nt), index(idx), mother(mot), nesting(nest) { }
+static const char* nodeTypeName(NodeType type) {
+    switch (type) {
+        case NodeType::DIRECTORY: return "DIRECTORY";
+        case NodeType::TTREE:     return "TTREE";
+        case NodeType::BRANCH:    return "BRANCH";
+        case NodeType::TLEAF:     return "TLEAF";
+        case NodeType::HIST:      return "HIST";
+        case NodeType::UNKNOWN:   return "UNKNOWN";
+    }
+    return "UNKNOWN";
+}
+
+static NodeType nodeTypeFromName(const std::string& name) {
+    if (name == "DIRECTORY") return NodeType::DIRECTORY;
+    if (name == "TTREE")     return NodeType::TTREE;
+    if (name == "BRANCH")    return NodeType::BRANCH;
+    if (name == "TLEAF")     return NodeType::TLEAF;
+    if (name == "HIST")      return NodeType::HIST;
+    return NodeType::UNKNOWN;
+}
+
+
+RootFile::Node::Node(const RootFile* file, NodeId id) : m_file(file), m_id(id) { }
+
+NodeType RootFile::Node::type() const { return m_file->m_nodes.type[m_id]; }
+int RootFile::Node::index() const { return m_file->m_nodes.index[m_id]; }
+RootFile::Node RootFile::Node::mother() const { return {m_file, m_file->m_nodes.parent[m_id]}; }
+int RootFile::Node::nesting() const { return m_file->m_nodes.nesting[m_id]; }
+bool RootFile::Node::isOpen() const { return m_file->m_nodes.has(m_id, NodeStore::DIR_OPEN); }
+bool RootFile::Node::isListed() const { return m_file->m_nodes.has(m_id, NodeStore::LISTED); }
+bool RootFile::Node::showInSearch() const { return m_file->m_nodes.has(m_id, NodeStore::SEARCH_MATCH); }
+bool RootFile::Node::populated() const { return m_file->m_nodes.has(m_id, NodeStore::POPULATED); }
+RootFile::NodeId RootFile::Node::id() const { return m_id; }
+
+RootFile::NodeId RootFile::NodeStore::add(NodeType nt, int idx, NodeId mother, int nest, std::string_view nodeName) {
+    const NodeId id = type.size();
+    type.push_back(nt);
+    flags.push_back(0);
+    nesting.push_back(nest);
+    parent.push_back(mother);
+    firstChild.push_back(no_node);
+    lastChild.push_back(no_node);
+    nextSibling.push_back(no_node);
+    index.push_back(idx);
+    menuIndex.push_back(-1);
+    name.push_back(nodeName);
+    if (nt == NodeType::TTREE || nt == NodeType::BRANCH) {
+        unread++;
+    }
+    if (mother != no_node) {
+        if (lastChild[mother] == no_node) {
+            firstChild[mother] = id;
+        }
+        else {
+            nextSibling[lastChild[mother]] = id;
+        }
+        lastChild[mother] = id;
+    }
+    return id;
+}
+
+void RootFile::NodeStore::setPopulated(NodeId id) {
+    if ((type[id] == NodeType::TTREE || type[id] == NodeType::BRANCH) && !has(id, POPULATED)) {
+        unread--;
+    }
+    flags[id] |= POPULATED;
+}
 
 RootFile::~RootFile() {
+    m_stopIndexing = true;
+    if (m_indexer.joinable()) {
+        m_indexer.join();
+    }
+    if (m_cacheOutdated && !m_indexing && m_batches.empty()) {
+        // Trees opened since the last write are listed next time
+        writeIndexCache();
+    }
+    if (m_cacheWriter.joinable()) {
+        m_cacheWriter.join();
+    }
     if (m_tfile != nullptr) {
         if (m_tfile->IsOpen()) {
             m_tfile->Close();
@@ -17,120 +100,256 @@ RootFile::~RootFile() {
     }
 }
 
-void RootFile::load(std::string filename) {
-    traverseTFile(filename);
+void RootFile::load(std::string filename, const std::filesystem::path& cacheDir, std::function<void()> notify) {
+    namespace fs = std::filesystem;
+    m_notify = std::move(notify);
+    openTFile(filename);
+
+    if (!cacheDir.empty()) {
+        m_cacheFile = cacheDir / fmtstring("{}.json", m_tfile->GetUUID().AsString());
+        m_fileSize = fs::file_size(filename);
+        m_fileMtime = fs::last_write_time(filename).time_since_epoch().count();
+    }
+
+    // Open stuff, content is attached as soon as it is indexed
+    m_nodes.flags[root_id] |= NodeStore::LISTED;
+    toggleOpenOnClick(root_id);
     populateMenu();
+    openObviousDirectory(root_id);
+
+    m_indexing = true;
+    m_indexer = std::thread(&RootFile::indexFile, this);
+}
+
+void RootFile::indexFile() {
+    if (!readIndexCache()) {
+        m_dirsFound = 1;
+        indexSubdirectories({{m_tfile.get(), 0, 0}});
+        m_cacheOutdated = !m_stopIndexing;
+    }
+    m_indexing = false;
+    if (m_notify) {
+        m_notify();
+    }
+}
+
+bool RootFile::mergeIndexed() {
+    std::vector<IndexBatch> batches;
+    {
+        std::lock_guard lock(m_batch_mutex);
+        std::swap(batches, m_batches);
+    }
+    for (auto& batch : batches) {
+        attachBatch(batch);
+    }
+    if (!batches.empty()) {
+        // One pass in tree order, a restored cache can bring a batch per branch
+        populateMenu();
+    }
+    if (m_obviousNode != no_node && m_nodes.has(m_obviousNode, NodeStore::POPULATED)) {
+        openObviousDirectory(m_obviousNode);
+    }
+    if (!m_indexing && m_cacheOutdated && !m_cacheWriting) {
+        // Indexing done and everything merged
+        writeIndexCache();
+    }
+    return !batches.empty();
+}
+
+bool RootFile::isIndexing() const {
+    return m_indexing;
+}
+
+std::pair<int, int> RootFile::indexProgress() const {
+    return {m_dirsIndexed, m_dirsFound};
+}
+
+const char* RootFile::nodeName(NodeType type, int index) {
+    switch (type) {
+        case NodeType::DIRECTORY: return m_directories[index].name();
+        case NodeType::TTREE:     return m_trees[index].name();
+        case NodeType::BRANCH:    return m_branches[index].name();
+        case NodeType::TLEAF:     return m_leaves[index].name();
+        case NodeType::HIST:      return m_histos_th1d[index].name();
+        case NodeType::UNKNOWN:   return m_unclassified[index].name();
+    }
+    return "";
 }
 
 void RootFile::populateMenu() {
     // Make flat file structure list for quick redraw
     displayList.clear();
-    displayList.emplace_back(m_directories[root_node.index]->GetName(), &root_node);
-    populateMenu(&root_node);
-}
-
-void RootFile::populateMenu(Node* mothernode, int nesting) {
-    for (auto& node : mothernode->nodes) {
-        switch (node->type) {
-            case NodeType::DIRECTORY:
-                displayList.emplace_back(m_directories[node->index]->GetName(), node.get());
-                populateMenu(node.get(), nesting + 1);
-                break;
-            case NodeType::TTREE:
-                displayList.emplace_back(m_trees[node->index]->GetName(), node.get());
-                populateMenu(node.get(), nesting + 1);
-                break;
-            case NodeType::TLEAF:
-                displayList.emplace_back(m_leaves[node->index]->GetName(), node.get());
-                break;
-            case NodeType::HIST:
-                displayList.emplace_back(m_histos_th1d[node->index]->GetName(), node.get());
-                break;
-            case NodeType::UNKNOWN:
-                displayList.emplace_back(m_unclassified[node->index]->GetName(), node.get());
-                break;
-            default: break;
-        }
+    displayList.emplace_back(m_nodes.name[root_id], Node(this, root_id));
+    populateMenu(root_id);
+    rebuildMenuIndex();
+}
+
+void RootFile::populateMenu(NodeId mother) {
+    for (NodeId child = m_nodes.firstChild[mother]; child != no_node; child = m_nodes.nextSibling[child]) {
+        displayList.emplace_back(m_nodes.name[child], Node(this, child));
+        populateMenu(child);
     }
 }
 
+void RootFile::insertMenuItems(NodeId mother) {
+    // List children of a single newly populated node right below it. Index
+    // is rebuilt by caller
+    if (m_nodes.menuIndex[mother] < 0) {
+        // Menu not built yet
+        return;
+    }
+    std::vector<MenuItem> items;
+    for (NodeId child = m_nodes.firstChild[mother]; child != no_node; child = m_nodes.nextSibling[child]) {
+        items.emplace_back(m_nodes.name[child], Node(this, child));
+    }
+    const int insertPos = m_nodes.menuIndex[mother] + 1;
+    displayList.insert(displayList.begin() + insertPos, items.begin(), items.end());
+    // Keep positions valid for following insertions of the same batch
+    for (int j = insertPos; j < static_cast<int>(displayList.size()); ++j) {
+        m_nodes.menuIndex[std::get<1>(displayList[j]).id()] = j;
+    }
+}
+
+void RootFile::rebuildMenuIndex() {
+    // O(n), only needed when entries are inserted
+    std::vector<int> listed(displayList.size());
+    std::vector<int> found(displayList.size());
+    for (int j = 0; const auto& [_, node] : displayList) {
+        const NodeId id = node.id();
+        m_nodes.menuIndex[id] = j;
+        listed[j] = m_nodes.has(id, NodeStore::LISTED);
+        found[j] = m_nodes.has(id, NodeStore::SEARCH_MATCH);
+        j++;
+    }
+    m_listedIndex.assign(listed);
+    m_searchIndex.assign(found);
+}
+
 std::optional<RootFile::MenuItem> RootFile::getEntry(int i, bool searchMode) {
     // Return reference to i-th open entry
-    int entry = 0;
-    for (int j = 0; auto& [_, node] : displayList) {
-        bool criterion = searchMode ? node->showInSearch : node->openState & RootFile::Node::LISTED;
-        if (criterion) {
-            if (entry == i) {
-                return displayList[j];
-            }
-            entry++;
-        }
-        j++;
+    const int j = searchMode ? m_searchIndex.find(i) : m_listedIndex.find(i);
+    if (j >= static_cast<int>(displayList.size())) {
+        return std::nullopt;
     }
-    return std::nullopt;
+    return displayList[j];
 }
 
 int RootFile::menuLength(bool searchMode) {
     // Return number of open entries
-    int length = 0;
-    if (searchMode) {
-        for (const auto& [_, node] : displayList) {
-            if (node->showInSearch) {
-                length++;
-            }
-        }
+    return searchMode ? m_searchIndex.total() : m_listedIndex.total();
+}
+
+void RootFile::search(const std::string& pattern) {
+    // Unread trees are not read here, that would block typing on large files
+    m_searchPattern = pattern;
+    for (const auto& [name, node] : displayList) {
+        markSearchMatch(node.id());
     }
-    else {
-        for (const auto& [_, node] : displayList) {
-            if (node->openState & RootFile::Node::LISTED) {
-                length++;
-            }
+    rebuildMenuIndex();
+}
+
+void RootFile::markSearchMatch(NodeId id) {
+    // Only leaves can match, everything else is always hidden
+    const bool match = m_nodes.type[id] == NodeType::TLEAF &&
+                       (m_searchPattern.empty() || string_contains(m_nodes.name[id], m_searchPattern));
+    m_nodes.flags[id] = match ? m_nodes.flags[id] | NodeStore::SEARCH_MATCH
+                              : m_nodes.flags[id] & ~NodeStore::SEARCH_MATCH;
+}
+
+bool RootFile::hasUnreadTrees() {
+    for (; m_unreadTree < static_cast<NodeId>(m_nodes.size()); ++m_unreadTree) {
+        const NodeType type = m_nodes.type[m_unreadTree];
+        if ((type == NodeType::TTREE || type == NodeType::BRANCH) && !m_nodes.has(m_unreadTree, NodeStore::POPULATED)) {
+            return true;
         }
     }
-    return length;
+    // Trees attached later by the indexer and branches read from trees are appended after m_unreadTree
+    return false;
 }
 
-void RootFile::Node::toggleOpenOnClick() {
-    if (type == NodeType::DIRECTORY || type == NodeType::TTREE) {
-        openState ^= DIR_OPEN;
-        recurseOpen(openState & DIR_OPEN);
+int RootFile::unreadTrees() const {
+    return m_nodes.unread;
+}
+
+bool RootFile::readNextTree() {
+    if (!hasUnreadTrees()) {
+        return false;
+    }
+    populateTree(m_unreadTree);
+    rebuildMenuIndex();
+    m_cacheOutdated = true;
+    return true;
+}
+
+void RootFile::toggleOpenOnClick(NodeId id) {
+    if (is_container(m_nodes.type[id])) {
+        m_nodes.flags[id] ^= NodeStore::DIR_OPEN;
+        recurseOpen(id, m_nodes.has(id, NodeStore::DIR_OPEN));
     }
 }
 
-void RootFile::Node::recurseOpen(bool open) {
-    for (auto& child : nodes) {
+void RootFile::recurseOpen(NodeId id, bool open) {
+    for (NodeId child = m_nodes.firstChild[id]; child != no_node; child = m_nodes.nextSibling[child]) {
+        const bool wasListed = m_nodes.has(child, NodeStore::LISTED);
         if (open) {
-            child->openState |= LISTED;
+            m_nodes.flags[child] |= NodeStore::LISTED;
         }
         else {
-            child->openState ^= LISTED;
+            m_nodes.flags[child] ^= NodeStore::LISTED;
+        }
+        const bool isListed = m_nodes.has(child, NodeStore::LISTED);
+        if (m_nodes.menuIndex[child] >= 0 && wasListed != isListed) {
+            m_listedIndex.add(m_nodes.menuIndex[child], isListed ? 1 : -1);
         }
 
-        if ((child->type == NodeType::DIRECTORY || child->type == NodeType::TTREE) && child->openState & DIR_OPEN) {
+        if (is_container(m_nodes.type[child]) && m_nodes.has(child, NodeStore::DIR_OPEN)) {
             // If subfolder is opened and now listed, list its contents as well
-            child->recurseOpen(open);
+            recurseOpen(child, open);
         }
     }
 }
 
-std::string RootFile::toString(Node* node) {
-    std::string descr;
-    std::string name;
-    std::string title;
-    std::string classname;
-    auto make_name = [this, &name, &title, &classname, &node](TObject* obj){
-        name = obj->GetName();
-        title = obj->GetTitle();
-        classname = obj->ClassName();
-        
+void RootFile::toggleOpen(Node node) {
+    const NodeId id = node.id();
+    const NodeType type = m_nodes.type[id];
+    if ((type == NodeType::TTREE || type == NodeType::BRANCH) && !m_nodes.has(id, NodeStore::POPULATED)) {
+        populateTree(id);
+        rebuildMenuIndex();
+        m_cacheOutdated = true;
+    }
+    toggleOpenOnClick(id);
+}
+
+int RootFile::treeIndex(Node node) const {
+    for (NodeId id = node.id(); id != no_node; id = m_nodes.parent[id]) {
+        if (m_nodes.type[id] == NodeType::TTREE) {
+            return m_nodes.index[id];
+        }
+    }
+    return -1;
+}
+
+std::string RootFile::toString(Node node) {
+    // Only uses key metadata, selecting an entry never reads the object
+    auto make_name = [this, &node](const std::string& name, const std::string& title,
+                                   const std::string& classname, short cycle){
         Long64_t nEntries = -1;
-        if (node->type == NodeType::TTREE) {
-            nEntries = m_trees[node->index]->GetEntriesFast();
+        if (node.type() == NodeType::TTREE) {
+            auto& tree = m_trees[node.index()];
+            if (tree.isLoaded()) {
+                nEntries = tree->GetEntriesFast();
+            }
+            else if (tree.info() != nullptr) {
+                nEntries = tree.info()->entries;
+            }
         }
 
         std::string info;
 
         info = fmtstring("({}) {}", classname, name);
+        if (cycle > 1) {
+            info += fmtstring(";{}", cycle);
+        }
         if (!title.empty() && name != title) {
             info += fmtstring(" \"{}\"", title);
         }
@@ -139,86 +358,357 @@ std::string RootFile::toString(Node* node) {
         }
         return info;
     };
-    switch (node->type) {
-        case NodeType::DIRECTORY: descr = make_name(m_directories[node->index]);  break;
-        case NodeType::TTREE:     descr = make_name(m_trees[node->index]);        break;
-        case NodeType::TLEAF:     descr = make_name(m_leaves[node->index]);       break;
-        case NodeType::HIST:      descr = make_name(m_histos_th1d[node->index]);  break;
-        case NodeType::UNKNOWN:   descr = make_name(m_unclassified[node->index]); break;
+    auto describe = [&make_name](auto& handle) {
+        return make_name(handle.name(), handle.title(), handle.className(), handle.cycle());
+    };
+
+    std::string descr;
+    switch (node.type()) {
+        case NodeType::DIRECTORY: descr = describe(m_directories[node.index()]);  break;
+        case NodeType::TTREE:     descr = describe(m_trees[node.index()]);        break;
+        case NodeType::BRANCH:    descr = describe(m_branches[node.index()]);     break;
+        case NodeType::TLEAF:     descr = describe(m_leaves[node.index()]);       break;
+        case NodeType::HIST:      descr = describe(m_histos_th1d[node.index()]);  break;
+        case NodeType::UNKNOWN:   descr = describe(m_unclassified[node.index()]); break;
     }
 
     return descr;
 }
 
-void RootFile::traverseTFile(TDirectory* dir, RootFile::Node* node, int depth) {
+RootFile::IndexBatch RootFile::indexDirectory(TDirectory* dir, int mother, int depth) {
+    IndexBatch batch;
+    batch.mother = mother;
+    batch.depth = depth;
+
+    std::lock_guard lock(root_io_mutex);
     TList* keys = dir->GetListOfKeys();
     if (keys == nullptr) {
-        return;
+        return batch;
     }
 
     for (int i = 0; i < keys->GetSize(); ++i) {
+        // Classify by key metadata only. Objects are read on first use
         TKey* key = dynamic_cast<TKey*>(keys->At(i));
-        TObject* obj = key->ReadObj();
+        const char* classname = key->GetClassName();
+        TClass* objclass = TClass::GetClass(classname);
 
-        if (strcmp(key->GetClassName(), "TTree") == 0) {
-            auto* tree = dynamic_cast<TTree*>(obj);
-            m_trees.push_back(tree);
-            node->nodes.emplace_back(std::make_unique<RootFile::Node>(NodeType::TTREE, m_trees.size() - 1, node, depth));
-            readBranches(node->nodes.back().get(), tree, depth + 1);
+        IndexedKey entry;
+        entry.key = key;
+        if (strcmp(classname, "TTree") == 0) {
+            entry.type = NodeType::TTREE;
+            entry.pendingId = m_nextPendingId++;
+        }
+        else if (strcmp(classname, "TH1D") == 0) {
+            entry.type = NodeType::HIST;
+        }
+        else if (objclass != nullptr && objclass->InheritsFrom(TDirectory::Class())) {
+            // Directories have to be read to list their keys
+            entry.type = NodeType::DIRECTORY;
+            entry.pendingId = m_nextPendingId++;
+            entry.dir = dynamic_cast<TDirectory*>(key->ReadObj());
         }
-        else if (strcmp(key->GetClassName(), "TH1D") == 0) {
-            m_histos_th1d.push_back(dynamic_cast<TH1D*>(obj));
-            node->nodes.emplace_back(std::make_unique<RootFile::Node>(NodeType::HIST, m_histos_th1d.size() - 1, node, depth));
+        batch.entries.push_back(std::move(entry));
+    }
+    return batch;
+}
+
+void RootFile::indexSubdirectories(std::deque<std::tuple<TDirectory*, int, int>> pending) {
+    // Breadth first, so that upper levels become available first
+    while (!pending.empty() && !m_stopIndexing) {
+        auto [dir, mother, depth] = pending.front();
+        pending.pop_front();
+
+        auto batch = indexDirectory(dir, mother, depth);
+        for (auto& entry : batch.entries) {
+            if (entry.dir != nullptr) {
+                pending.emplace_back(entry.dir, entry.pendingId, depth + 1);
+                m_dirsFound++;
+            }
         }
-        else if (obj->IsA()->InheritsFrom(TDirectory::Class())) {
-            m_directories.push_back(dynamic_cast<TDirectory*>(obj));
-            node->nodes.emplace_back(std::make_unique<RootFile::Node>(NodeType::DIRECTORY, m_directories.size() - 1, node, depth));
-            traverseTFile(dynamic_cast<TDirectory*>(obj), node->nodes.back().get(), depth + 1);
+        m_dirsIndexed++;
+
+        std::vector<IndexBatch> batches;
+        batches.push_back(std::move(batch));
+        publish(std::move(batches));
+    }
+}
+
+void RootFile::publish(std::vector<IndexBatch>&& batches) {
+    bool wake = false;
+    {
+        std::lock_guard lock(m_batch_mutex);
+        wake = m_batches.empty(); // Otherwise UI has not merged the last notification yet
+        std::move(batches.begin(), batches.end(), std::back_inserter(m_batches));
+    }
+    if (wake && m_notify) {
+        m_notify();
+    }
+}
+
+void RootFile::attachBatch(IndexBatch& batch) {
+    const NodeId mother = batch.mother == 0 ? root_id : m_pendingNodes.at(batch.mother);
+    if (m_nodes.has(mother, NodeStore::POPULATED)) {
+        // Tree has been opened (and read) in the meantime
+        return;
+    }
+    const bool listed = m_nodes.has(mother, NodeStore::DIR_OPEN) && m_nodes.has(mother, NodeStore::LISTED);
+    for (auto& entry : batch.entries) {
+        const NodeType type = entry.type;
+        if (entry.info.has_value()) {
+            // From cache, the object is located by path when needed. Leaves and
+            // branches capture indices only, which std::function stores without allocating
+            std::function<TObject*()> locate;
+            if (type == NodeType::TLEAF) {
+                locate = [this, tree = treeIndex(Node(this, mother)), leaf = int(m_leaves.size())]() -> TObject* {
+                    TTree* ttree = m_trees[tree].get();
+                    return ttree ? ttree->GetLeaf(m_leaves[leaf].name()) : nullptr;
+                };
+            }
+            else if (type == NodeType::BRANCH) {
+                locate = [this, tree = treeIndex(Node(this, mother)), branch = int(m_branches.size())]() -> TObject* {
+                    TTree* ttree = m_trees[tree].get();
+                    return ttree ? ttree->GetBranch(m_branches[branch].name()) : nullptr;
+                };
+            }
+            else if (type == NodeType::DIRECTORY) {
+                locate = [this, path = entry.path]() -> TObject* { return m_tfile->GetDirectory(path.c_str()); };
+            }
+            else {
+                locate = [this, path = fmtstring("{};{}", entry.path, entry.info->cycle)]() -> TObject* {
+                    return m_tfile->Get(path.c_str());
+                };
+            }
+            const ObjectInfo* info = &m_cachedInfo.emplace_back(std::move(*entry.info));
+            switch (type) {
+                case NodeType::DIRECTORY: m_directories.emplace_back(info, std::move(locate));  break;
+                case NodeType::TTREE:     m_trees.emplace_back(info, std::move(locate));        break;
+                case NodeType::BRANCH:    m_branches.emplace_back(info, std::move(locate));     break;
+                case NodeType::TLEAF:     m_leaves.emplace_back(info, std::move(locate));       break;
+                case NodeType::HIST:      m_histos_th1d.emplace_back(info, std::move(locate));  break;
+                case NodeType::UNKNOWN:   m_unclassified.emplace_back(info, std::move(locate)); break;
+            }
         }
         else {
-            m_unclassified.push_back(obj);
-            node->nodes.emplace_back(std::make_unique<RootFile::Node>(NodeType::UNKNOWN, m_unclassified.size() - 1, node, depth));
+            switch (type) {
+                case NodeType::DIRECTORY: m_directories.emplace_back(entry.key, entry.dir); break;
+                case NodeType::TTREE:     m_trees.emplace_back(entry.key);                  break;
+                case NodeType::HIST:      m_histos_th1d.emplace_back(entry.key);            break;
+                default:                  m_unclassified.emplace_back(entry.key);           break;
+            }
+        }
+        int index = -1;
+        switch (type) {
+            case NodeType::DIRECTORY: index = m_directories.size() - 1;  break;
+            case NodeType::TTREE:     index = m_trees.size() - 1;        break;
+            case NodeType::BRANCH:    index = m_branches.size() - 1;     break;
+            case NodeType::TLEAF:     index = m_leaves.size() - 1;       break;
+            case NodeType::HIST:      index = m_histos_th1d.size() - 1;  break;
+            case NodeType::UNKNOWN:   index = m_unclassified.size() - 1; break;
+        }
+        const NodeId id = m_nodes.add(type, index, mother, batch.depth, m_names.intern(nodeName(type, index)));
+        if (listed) {
+            m_nodes.flags[id] |= NodeStore::LISTED;
         }
+        markSearchMatch(id);
+        if (entry.pendingId > 0) {
+            if (entry.pendingId >= static_cast<int>(m_pendingNodes.size())) {
+                m_pendingNodes.resize(entry.pendingId + 1, no_node);
+            }
+            m_pendingNodes[entry.pendingId] = id;
+        }
+    }
+    m_nodes.setPopulated(mother);
+}
+
+bool RootFile::readIndexCache() {
+    // Rebuild the structure from the cache without touching any TKey
+    if (m_cacheFile.empty() || !std::filesystem::exists(m_cacheFile)) {
+        return false;
+    }
+    JSON cache;
+    try {
+        std::ifstream cacheStream(m_cacheFile);
+        cacheStream >> cache;
+        if (cache.value("version", 0) != index_cache_version ||
+            cache.value("size", std::uintmax_t(0)) != m_fileSize ||
+            cache.value("mtime", 0LL) != m_fileMtime) {
+            return false;
+        }
+
+        // Batches in breadth first order, mothers are attached before their children
+        std::vector<IndexBatch> batches;
+        std::deque<std::tuple<const JSON*, int, int, std::string>> pending;
+        pending.emplace_back(&cache.at("root"), 0, 0, "");
+        while (!pending.empty()) {
+            auto [json, mother, depth, path] = pending.front();
+            pending.pop_front();
+            if (!json->contains("nodes")) {
+                // Tree that was never opened
+                continue;
+            }
+
+            IndexBatch batch;
+            batch.mother = mother;
+            batch.depth = depth;
+            for (const auto& child : json->at("nodes")) {
+                IndexedKey entry;
+                entry.type = nodeTypeFromName(child.at("type"));
+                entry.info.emplace();
+                entry.info->name = child.at("name");
+                entry.info->title = child.value("title", "");
+                entry.info->classname = child.value("class", "");
+                entry.info->cycle = child.value("cycle", 0);
+                entry.info->entries = child.value("entries", -1LL);
+                entry.path = path.empty() ? entry.info->name : fmtstring("{}/{}", path, entry.info->name);
+                if (is_container(entry.type)) {
+                    entry.pendingId = m_nextPendingId++;
+                    pending.emplace_back(&child, entry.pendingId, depth + 1, entry.path);
+                }
+                batch.entries.push_back(std::move(entry));
+            }
+            batches.push_back(std::move(batch));
+        }
+        publish(std::move(batches));
+    }
+    catch (const JSON::exception&) {
+        return false;
+    }
+    return true;
+}
+
+void RootFile::writeIndexCache() {
+    // Serialize on the UI thread, write in the background
+    if (m_cacheFile.empty()) {
+        return;
+    }
+    std::function<JSON(NodeId)> serialize = [this, &serialize](NodeId id) {
+        JSON json;
+        const NodeType type = m_nodes.type[id];
+        const int index = m_nodes.index[id];
+        json["type"] = nodeTypeName(type);
+        auto describe = [&json](auto& handle) {
+            json["name"] = handle.name();
+            json["title"] = handle.title();
+            json["class"] = handle.className();
+            json["cycle"] = handle.cycle();
+        };
+        switch (type) {
+            case NodeType::DIRECTORY: describe(m_directories[index]);  break;
+            case NodeType::TTREE:     describe(m_trees[index]);        break;
+            case NodeType::BRANCH:    describe(m_branches[index]);     break;
+            case NodeType::TLEAF:     describe(m_leaves[index]);       break;
+            case NodeType::HIST:      describe(m_histos_th1d[index]);  break;
+            case NodeType::UNKNOWN:   describe(m_unclassified[index]); break;
+        }
+        if (type == NodeType::TTREE) {
+            auto& tree = m_trees[index];
+            if (tree.isLoaded()) {
+                json["entries"] = tree->GetEntriesFast();
+            }
+            else if (tree.info() != nullptr) {
+                json["entries"] = tree.info()->entries;
+            }
+        }
+        if (m_nodes.has(id, NodeStore::POPULATED)) {
+            json["nodes"] = JSON::array();
+            for (NodeId child = m_nodes.firstChild[id]; child != no_node; child = m_nodes.nextSibling[child]) {
+                json["nodes"].push_back(serialize(child));
+            }
+        }
+        return json;
+    };
+
+    JSON cache;
+    cache["version"] = index_cache_version;
+    cache["size"] = m_fileSize;
+    cache["mtime"] = m_fileMtime;
+    cache["root"] = serialize(root_id);
+    m_cacheOutdated = false;
+
+    // One write at a time, the previous one has to finish before its file is replaced
+    if (m_cacheWriter.joinable()) {
+        m_cacheWriter.join();
     }
+    m_cacheWriting = true;
+    m_cacheWriter = std::thread([this, cacheFile = m_cacheFile, cache = std::move(cache)](){
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        fs::create_directories(cacheFile.parent_path(), ec);
+        auto tmpFile = cacheFile;
+        tmpFile += ".tmp";
+        if (std::ofstream out(tmpFile); out.is_open()) {
+            out << cache.dump();
+            out.close();
+            fs::rename(tmpFile, cacheFile, ec);
+        }
+        m_cacheWriting = false;
+    });
 }
 
-void RootFile::traverseTFile(std::string& filename) {
+void RootFile::openTFile(std::string& filename) {
     m_tfile = std::unique_ptr<TFile>(TFile::Open(filename.c_str(), "READ"));
     if (!m_tfile || m_tfile->IsZombie()) {
         throw std::runtime_error("Not a root file or broken file");
     }
 
-    m_directories.push_back(m_tfile.get());
-    root_node.index = 0;
-    root_node.type = NodeType::DIRECTORY;
-    traverseTFile(m_tfile.get(), &root_node);
+    m_directories.emplace_back(static_cast<TDirectory*>(m_tfile.get()));
+    m_nodes.add(NodeType::DIRECTORY, 0, no_node, 0, m_names.intern(m_directories[0].name()));
+}
 
-    // Open stuff
-    root_node.openState |= RootFile::Node::LISTED;
-    root_node.toggleOpenOnClick();
-    openObviousDirectory(&root_node);
+void RootFile::readBranches(NodeId node, TObjArray* branches, int depth) {
+    // Split branches become nodes that are read on open, other branches are shown by their leaves
+    for (auto* obj : *branches) {
+        auto* branch = dynamic_cast<TBranch*>(obj);
+        if (branch->GetListOfBranches()->GetEntriesFast() > 0) {
+            m_branches.emplace_back(branch);
+            m_nodes.add(NodeType::BRANCH, m_branches.size() - 1, node, depth, m_names.intern(m_branches.back().name()));
+            continue;
+        }
+        for (auto* leaf : *branch->GetListOfLeaves()) {
+            m_leaves.emplace_back(dynamic_cast<TLeaf*>(leaf));
+            markSearchMatch(m_nodes.add(NodeType::TLEAF, m_leaves.size() - 1, node, depth,
+                                        m_names.intern(m_leaves.back().name())));
+        }
+    }
 }
 
-void RootFile::readBranches(RootFile::Node* node, TTree* tree, int depth) {
-    for (auto* leaf : *tree->GetListOfLeaves()) {
-        m_leaves.push_back(dynamic_cast<TLeaf*>(leaf));
-        node->nodes.emplace_back(std::make_unique<RootFile::Node>(
-                    NodeType::TLEAF, m_leaves.size() - 1, node, depth));
+void RootFile::populateTree(NodeId node) {
+    // Read tree header or branch on first open and list its branches below it
+    m_nodes.setPopulated(node);
+    TObjArray* branches = nullptr;
+    if (m_nodes.type[node] == NodeType::TTREE) {
+        TTree* tree = m_trees[m_nodes.index[node]].get();
+        branches = tree ? tree->GetListOfBranches() : nullptr;
+    }
+    else {
+        TBranch* branch = m_branches[m_nodes.index[node]].get();
+        branches = branch ? branch->GetListOfBranches() : nullptr;
     }
+    if (branches == nullptr) {
+        return;
+    }
+    readBranches(node, branches, m_nodes.nesting[node] + 1);
+    insertMenuItems(node);
 }
 
-void RootFile::openObviousDirectory(Node* node) {
+void RootFile::openObviousDirectory(NodeId node) {
+    if (m_nodes.type[node] == NodeType::DIRECTORY && !m_nodes.has(node, NodeStore::POPULATED)) {
+        // Continue once the directory has been indexed
+        m_obviousNode = node;
+        return;
+    }
+    m_obviousNode = no_node;
     int dirCount = 0;
-    Node* gotoDir = nullptr;
-    for (const auto& child : node->nodes) {
-        if (child->type == NodeType::DIRECTORY || child->type == NodeType::TTREE) {
+    NodeId gotoDir = no_node;
+    for (NodeId child = m_nodes.firstChild[node]; child != no_node; child = m_nodes.nextSibling[child]) {
+        if (m_nodes.type[child] == NodeType::DIRECTORY || m_nodes.type[child] == NodeType::TTREE) {
             dirCount++;
-            gotoDir = child.get();
+            gotoDir = child;
         }
     }
 
     if (dirCount == 1) {
-        gotoDir->toggleOpenOnClick();
+        toggleOpen(Node(this, gotoDir));
         openObviousDirectory(gotoDir);
     }
 }
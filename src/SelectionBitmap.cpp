@@ -0,0 +1,222 @@
+#include "SelectionBitmap.h"
+#include <algorithm>
+#include <bit>
+#include <iterator>
+
+void SelectionBitmap::add(Long64_t entry) {
+    const Long64_t key = entry >> chunk_bits;
+    const auto low = static_cast<std::uint16_t>(entry & 0xFFFF);
+    if (m_chunks.empty() || m_chunks.back().key != key) {
+        m_chunks.emplace_back().key = key;
+    }
+    Chunk& chunk = m_chunks.back();
+    if (chunk.bits.empty()) {
+        chunk.array.push_back(low);
+    }
+    else {
+        chunk.bits[low / 64] |= std::uint64_t(1) << (low % 64);
+    }
+    chunk.cardinality++;
+    if (chunk.cardinality == max_array + 1) {
+        chunk.normalize();
+    }
+}
+
+bool SelectionBitmap::contains(Long64_t entry) const {
+    const Long64_t key = entry >> chunk_bits;
+    const auto it = std::lower_bound(m_chunks.begin(), m_chunks.end(), key,
+                                     [](const Chunk& chunk, Long64_t k) { return chunk.key < k; });
+    return it != m_chunks.end() && it->key == key && it->contains(static_cast<std::uint16_t>(entry & 0xFFFF));
+}
+
+Long64_t SelectionBitmap::count() const {
+    Long64_t total = 0;
+    for (const auto& chunk : m_chunks) {
+        total += chunk.cardinality;
+    }
+    return total;
+}
+
+bool SelectionBitmap::any(Long64_t first, Long64_t last) const {
+    auto it = std::lower_bound(m_chunks.begin(), m_chunks.end(), first >> chunk_bits,
+                               [](const Chunk& chunk, Long64_t k) { return chunk.key < k; });
+    for (; it != m_chunks.end() && (it->key << chunk_bits) < last; ++it) {
+        const auto [lo, hi] = lowRange(*it, first, last);
+        if (it->any(lo, hi)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SelectionBitmap::entries(Long64_t first, Long64_t last, std::vector<Long64_t>& out) const {
+    auto it = std::lower_bound(m_chunks.begin(), m_chunks.end(), first >> chunk_bits,
+                               [](const Chunk& chunk, Long64_t k) { return chunk.key < k; });
+    for (; it != m_chunks.end() && (it->key << chunk_bits) < last; ++it) {
+        const auto [lo, hi] = lowRange(*it, first, last);
+        it->entries(lo, hi, out);
+    }
+}
+
+SelectionBitmap SelectionBitmap::intersect(const SelectionBitmap& a, const SelectionBitmap& b) {
+    SelectionBitmap result;
+    auto ia = a.m_chunks.begin();
+    auto ib = b.m_chunks.begin();
+    while (ia != a.m_chunks.end() && ib != b.m_chunks.end()) {
+        if (ia->key != ib->key) {
+            (ia->key < ib->key ? ia : ib)++;
+            continue;
+        }
+        Chunk chunk;
+        chunk.key = ia->key;
+        if (!ia->bits.empty() && !ib->bits.empty()) {
+            chunk.bits.resize(chunk_words);
+            for (std::size_t w = 0; w < chunk_words; ++w) {
+                chunk.bits[w] = ia->bits[w] & ib->bits[w];
+                chunk.cardinality += std::popcount(chunk.bits[w]);
+            }
+        }
+        else if (ia->bits.empty() && ib->bits.empty()) {
+            std::set_intersection(ia->array.begin(), ia->array.end(), ib->array.begin(), ib->array.end(),
+                                  std::back_inserter(chunk.array));
+            chunk.cardinality = chunk.array.size();
+        }
+        else {
+            // The list of the sparse chunk, tested against the dense one
+            const Chunk& sparse = ia->bits.empty() ? *ia : *ib;
+            const Chunk& dense = ia->bits.empty() ? *ib : *ia;
+            std::copy_if(sparse.array.begin(), sparse.array.end(), std::back_inserter(chunk.array),
+                         [&dense](std::uint16_t low) { return dense.contains(low); });
+            chunk.cardinality = chunk.array.size();
+        }
+        if (chunk.cardinality > 0) {
+            chunk.normalize();
+            result.m_chunks.push_back(std::move(chunk));
+        }
+        ++ia;
+        ++ib;
+    }
+    return result;
+}
+
+SelectionBitmap SelectionBitmap::unite(const SelectionBitmap& a, const SelectionBitmap& b) {
+    SelectionBitmap result;
+    auto ia = a.m_chunks.begin();
+    auto ib = b.m_chunks.begin();
+    while (ia != a.m_chunks.end() || ib != b.m_chunks.end()) {
+        if (ib == b.m_chunks.end() || (ia != a.m_chunks.end() && ia->key < ib->key)) {
+            result.m_chunks.push_back(*ia++);
+            continue;
+        }
+        if (ia == a.m_chunks.end() || ib->key < ia->key) {
+            result.m_chunks.push_back(*ib++);
+            continue;
+        }
+        Chunk chunk;
+        chunk.key = ia->key;
+        if (ia->bits.empty() && ib->bits.empty()) {
+            std::set_union(ia->array.begin(), ia->array.end(), ib->array.begin(), ib->array.end(),
+                           std::back_inserter(chunk.array));
+            chunk.cardinality = chunk.array.size();
+        }
+        else {
+            chunk.bits.resize(chunk_words);
+            for (const Chunk* part : {&*ia, &*ib}) {
+                for (std::size_t w = 0; w < part->bits.size(); ++w) {
+                    chunk.bits[w] |= part->bits[w];
+                }
+                for (const std::uint16_t low : part->array) {
+                    chunk.bits[low / 64] |= std::uint64_t(1) << (low % 64);
+                }
+            }
+            for (const std::uint64_t word : chunk.bits) {
+                chunk.cardinality += std::popcount(word);
+            }
+        }
+        chunk.normalize();
+        result.m_chunks.push_back(std::move(chunk));
+        ++ia;
+        ++ib;
+    }
+    return result;
+}
+
+std::size_t SelectionBitmap::bytes() const {
+    std::size_t total = m_chunks.capacity() * sizeof(Chunk);
+    for (const auto& chunk : m_chunks) {
+        total += chunk.array.capacity() * sizeof(std::uint16_t) + chunk.bits.capacity() * sizeof(std::uint64_t);
+    }
+    return total;
+}
+
+std::pair<unsigned, unsigned> SelectionBitmap::lowRange(const Chunk& chunk, Long64_t first, Long64_t last) {
+    const Long64_t begin = chunk.key << chunk_bits;
+    const Long64_t end = begin + (Long64_t(1) << chunk_bits);
+    return {static_cast<unsigned>(std::max(first, begin) - begin), static_cast<unsigned>(std::min(last, end) - begin)};
+}
+
+bool SelectionBitmap::Chunk::contains(std::uint16_t low) const {
+    if (bits.empty()) {
+        return std::binary_search(array.begin(), array.end(), low);
+    }
+    return (bits[low / 64] >> (low % 64)) & 1;
+}
+
+bool SelectionBitmap::Chunk::any(unsigned lo, unsigned hi) const {
+    if (bits.empty()) {
+        const auto it = std::lower_bound(array.begin(), array.end(), lo);
+        return it != array.end() && *it < hi;
+    }
+    for (unsigned low = lo; low < hi; ++low) {
+        if (low % 64 == 0 && low + 64 <= hi) {
+            if (bits[low / 64] != 0) {
+                return true;
+            }
+            low += 63;
+        }
+        else if ((bits[low / 64] >> (low % 64)) & 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SelectionBitmap::Chunk::entries(unsigned lo, unsigned hi, std::vector<Long64_t>& out) const {
+    const Long64_t base = key << chunk_bits;
+    if (bits.empty()) {
+        for (auto it = std::lower_bound(array.begin(), array.end(), lo); it != array.end() && *it < hi; ++it) {
+            out.push_back(base + *it);
+        }
+        return;
+    }
+    for (unsigned w = lo / 64; w * 64 < hi; ++w) {
+        std::uint64_t word = bits[w];
+        while (word != 0) {
+            const unsigned low = w * 64 + std::countr_zero(word);
+            word &= word - 1;
+            if (low >= lo && low < hi) {
+                out.push_back(base + low);
+            }
+        }
+    }
+}
+
+void SelectionBitmap::Chunk::normalize() {
+    if (bits.empty() && cardinality > max_array) {
+        bits.assign(chunk_words, 0);
+        for (const std::uint16_t low : array) {
+            bits[low / 64] |= std::uint64_t(1) << (low % 64);
+        }
+        array = {};
+    }
+    else if (!bits.empty() && cardinality <= max_array) {
+        array.clear();
+        array.reserve(cardinality);
+        for (std::size_t w = 0; w < chunk_words; ++w) {
+            for (std::uint64_t word = bits[w]; word != 0; word &= word - 1) {
+                array.push_back(static_cast<std::uint16_t>(w * 64 + std::countr_zero(word)));
+            }
+        }
+        bits = {};
+    }
+}
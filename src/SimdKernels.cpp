@@ -0,0 +1,225 @@
+#include "SimdKernels.h"
+#include "definitions.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#else
+#define SIMD_X86 0
+#endif
+
+namespace {
+    // Scalar versions, also used for the tails of the vector loops
+
+    simd::Range minMaxScalar(const double* x, std::size_t n, simd::Range range) {
+        for (std::size_t i = 0; i < n; ++i) {
+            range.finite &= is_finite(x[i]);
+            range.min = std::min(range.min, x[i]);
+            range.max = std::max(range.max, x[i]);
+        }
+        return range;
+    }
+
+    void scaledBinsScalar(const double* x, std::size_t n, double scale, double offset, int nbins, int* bins) {
+        for (std::size_t i = 0; i < n; ++i) {
+            const double bin = std::floor(x[i] * scale) - offset;
+            bins[i] = bin >= 0 && bin < nbins ? static_cast<int>(bin) : -1;
+        }
+    }
+
+    void rangeBinsScalar(const double* x, std::size_t n, double lo, double hi, int nbins, int* bins) {
+        for (std::size_t i = 0; i < n; ++i) {
+            if (x[i] < lo || x[i] > hi) {
+                bins[i] = -1;
+                continue;
+            }
+            const int bin = (x[i] - lo) / (hi - lo) * nbins;
+            bins[i] = std::min(bin, nbins - 1);
+        }
+    }
+
+#if SIMD_X86
+    __attribute__((target("avx2")))
+    simd::Range minMaxAVX2(const double* x, std::size_t n) {
+        __m256d min = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+        __m256d max = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+        // Lanes with all exponent bits set, see is_finite
+        const __m256i exponent = _mm256_set1_epi64x(0x7FF0000000000000);
+        __m256i nonfinite = _mm256_setzero_si256();
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m256d v = _mm256_loadu_pd(x + i);
+            min = _mm256_min_pd(min, v);
+            max = _mm256_max_pd(max, v);
+            const __m256i bits = _mm256_and_si256(_mm256_castpd_si256(v), exponent);
+            nonfinite = _mm256_or_si256(nonfinite, _mm256_cmpeq_epi64(bits, exponent));
+        }
+        alignas(32) double lanes[2][4];
+        _mm256_store_pd(lanes[0], min);
+        _mm256_store_pd(lanes[1], max);
+        simd::Range range{lanes[0][0], lanes[1][0], static_cast<bool>(_mm256_testz_si256(nonfinite, nonfinite))};
+        for (int l = 1; l < 4; ++l) {
+            range.min = std::min(range.min, lanes[0][l]);
+            range.max = std::max(range.max, lanes[1][l]);
+        }
+        return minMaxScalar(x + i, n - i, range);
+    }
+
+    __attribute__((target("sse4.1")))
+    simd::Range minMaxSSE(const double* x, std::size_t n) {
+        __m128d min = _mm_set1_pd(std::numeric_limits<double>::infinity());
+        __m128d max = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+        const __m128i exponent = _mm_set1_epi64x(0x7FF0000000000000);
+        __m128i nonfinite = _mm_setzero_si128();
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            const __m128d v = _mm_loadu_pd(x + i);
+            min = _mm_min_pd(min, v);
+            max = _mm_max_pd(max, v);
+            const __m128i bits = _mm_and_si128(_mm_castpd_si128(v), exponent);
+            nonfinite = _mm_or_si128(nonfinite, _mm_cmpeq_epi64(bits, exponent));
+        }
+        alignas(16) double lanes[2][2];
+        _mm_store_pd(lanes[0], min);
+        _mm_store_pd(lanes[1], max);
+        simd::Range range{std::min(lanes[0][0], lanes[0][1]), std::max(lanes[1][0], lanes[1][1]),
+                          static_cast<bool>(_mm_testz_si128(nonfinite, nonfinite))};
+        return minMaxScalar(x + i, n - i, range);
+    }
+
+    __attribute__((target("avx2")))
+    void scaledBinsAVX2(const double* x, std::size_t n, double scale, double offset, int nbins, int* bins) {
+        const __m256d vscale = _mm256_set1_pd(scale);
+        const __m256d voffset = _mm256_set1_pd(offset);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d top = _mm256_set1_pd(nbins);
+        const __m256d none = _mm256_set1_pd(-1);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d bin = _mm256_sub_pd(_mm256_floor_pd(_mm256_mul_pd(_mm256_loadu_pd(x + i), vscale)), voffset);
+            const __m256d inside = _mm256_and_pd(_mm256_cmp_pd(bin, zero, _CMP_GE_OQ), _mm256_cmp_pd(bin, top, _CMP_LT_OQ));
+            bin = _mm256_blendv_pd(none, bin, inside);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(bins + i), _mm256_cvttpd_epi32(bin));
+        }
+        scaledBinsScalar(x + i, n - i, scale, offset, nbins, bins + i);
+    }
+
+    __attribute__((target("sse4.1")))
+    void scaledBinsSSE(const double* x, std::size_t n, double scale, double offset, int nbins, int* bins) {
+        const __m128d vscale = _mm_set1_pd(scale);
+        const __m128d voffset = _mm_set1_pd(offset);
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d top = _mm_set1_pd(nbins);
+        const __m128d none = _mm_set1_pd(-1);
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128d bin = _mm_sub_pd(_mm_floor_pd(_mm_mul_pd(_mm_loadu_pd(x + i), vscale)), voffset);
+            const __m128d inside = _mm_and_pd(_mm_cmpge_pd(bin, zero), _mm_cmplt_pd(bin, top));
+            bin = _mm_blendv_pd(none, bin, inside);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(bins + i), _mm_cvttpd_epi32(bin));
+        }
+        scaledBinsScalar(x + i, n - i, scale, offset, nbins, bins + i);
+    }
+
+    __attribute__((target("avx2")))
+    void rangeBinsAVX2(const double* x, std::size_t n, double lo, double hi, int nbins, int* bins) {
+        const __m256d vlo = _mm256_set1_pd(lo);
+        const __m256d vhi = _mm256_set1_pd(hi);
+        const __m256d width = _mm256_set1_pd(hi - lo);
+        const __m256d vnbins = _mm256_set1_pd(nbins);
+        const __m256d last = _mm256_set1_pd(nbins - 1);
+        const __m256d none = _mm256_set1_pd(-1);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m256d v = _mm256_loadu_pd(x + i);
+            // Same operations as the scalar version, so both give the same bins
+            __m256d bin = _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(v, vlo), width), vnbins);
+            bin = _mm256_min_pd(_mm256_floor_pd(bin), last);
+            const __m256d inside = _mm256_and_pd(_mm256_cmp_pd(v, vlo, _CMP_GE_OQ), _mm256_cmp_pd(v, vhi, _CMP_LE_OQ));
+            bin = _mm256_blendv_pd(none, bin, inside);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(bins + i), _mm256_cvttpd_epi32(bin));
+        }
+        rangeBinsScalar(x + i, n - i, lo, hi, nbins, bins + i);
+    }
+
+    __attribute__((target("sse4.1")))
+    void rangeBinsSSE(const double* x, std::size_t n, double lo, double hi, int nbins, int* bins) {
+        const __m128d vlo = _mm_set1_pd(lo);
+        const __m128d vhi = _mm_set1_pd(hi);
+        const __m128d width = _mm_set1_pd(hi - lo);
+        const __m128d vnbins = _mm_set1_pd(nbins);
+        const __m128d last = _mm_set1_pd(nbins - 1);
+        const __m128d none = _mm_set1_pd(-1);
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            const __m128d v = _mm_loadu_pd(x + i);
+            __m128d bin = _mm_mul_pd(_mm_div_pd(_mm_sub_pd(v, vlo), width), vnbins);
+            bin = _mm_min_pd(_mm_floor_pd(bin), last);
+            const __m128d inside = _mm_and_pd(_mm_cmpge_pd(v, vlo), _mm_cmple_pd(v, vhi));
+            bin = _mm_blendv_pd(none, bin, inside);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(bins + i), _mm_cvttpd_epi32(bin));
+        }
+        rangeBinsScalar(x + i, n - i, lo, hi, nbins, bins + i);
+    }
+#endif
+
+    enum class Level { SCALAR, SSE, AVX2 };
+
+    Level level() {
+#if SIMD_X86
+        static const Level detected = __builtin_cpu_supports("avx2") ? Level::AVX2
+                                      : __builtin_cpu_supports("sse4.1") ? Level::SSE
+                                      : Level::SCALAR;
+        return detected;
+#else
+        return Level::SCALAR;
+#endif
+    }
+}
+
+namespace simd {
+    Range minMax(const double* x, std::size_t n) {
+        const Range empty{std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), true};
+#if SIMD_X86
+        switch (level()) {
+            case Level::AVX2: return minMaxAVX2(x, n);
+            case Level::SSE:  return minMaxSSE(x, n);
+            default: break;
+        }
+#endif
+        return minMaxScalar(x, n, empty);
+    }
+
+    void scaledBins(const double* x, std::size_t n, double scale, double offset, int nbins, int* bins) {
+#if SIMD_X86
+        switch (level()) {
+            case Level::AVX2: scaledBinsAVX2(x, n, scale, offset, nbins, bins); return;
+            case Level::SSE:  scaledBinsSSE(x, n, scale, offset, nbins, bins); return;
+            default: break;
+        }
+#endif
+        scaledBinsScalar(x, n, scale, offset, nbins, bins);
+    }
+
+    void rangeBins(const double* x, std::size_t n, double lo, double hi, int nbins, int* bins) {
+#if SIMD_X86
+        switch (level()) {
+            case Level::AVX2: rangeBinsAVX2(x, n, lo, hi, nbins, bins); return;
+            case Level::SSE:  rangeBinsSSE(x, n, lo, hi, nbins, bins); return;
+            default: break;
+        }
+#endif
+        rangeBinsScalar(x, n, lo, hi, nbins, bins);
+    }
+
+    void accumulate(const int* bins, const double* w, std::size_t n, double* hist) {
+        for (std::size_t i = 0; i < n; ++i) {
+            if (bins[i] >= 0) {
+                hist[bins[i]] += w != nullptr ? w[i] : 1.0;
+            }
+        }
+    }
+}
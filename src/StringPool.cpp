@@ -0,0 +1,36 @@
+#include "StringPool.h"
+#include <cstring>
+
+std::string_view StringPool::intern(std::string_view str) {
+    if (str.empty()) {
+        // Needs no storage, and there may be no block to point into yet
+        return {};
+    }
+    if (auto found = m_strings.find(str); found != m_strings.end()) {
+        return *found;
+    }
+
+    char* storage = nullptr;
+    if (str.size() > block_size / 4) {
+        // Large strings get their own allocation, keeps the current block in use
+        m_large.push_back(std::make_unique<char[]>(str.size()));
+        storage = m_large.back().get();
+    }
+    else {
+        if (m_blockUsed + str.size() > block_size) {
+            m_blocks.push_back(std::make_unique<char[]>(block_size));
+            m_blockUsed = 0;
+        }
+        storage = m_blocks.back().get() + m_blockUsed;
+        m_blockUsed += str.size();
+    }
+    std::memcpy(storage, str.data(), str.size());
+
+    std::string_view interned(storage, str.size());
+    m_strings.insert(interned);
+    return interned;
+}
+
+std::size_t StringPool::size() const {
+    return m_strings.size();
+}
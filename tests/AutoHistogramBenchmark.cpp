@@ -0,0 +1,79 @@
+#include "AutoHistogram.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Filling point by point against the vectorized block fill, in blocks of
+// 4096 entries like the column path of DrawEngine. Points are taken in turn
+// from a pool of normally distributed values. Usage: benchmark [points]
+namespace {
+    constexpr std::size_t block = 4096;
+    constexpr std::size_t pool = std::size_t(1) << 22;
+
+    struct Data {
+        std::vector<double> x;
+        std::vector<double> y;
+        std::vector<double> w;
+    };
+
+    template <typename Fill>
+    double milliseconds(Fill fill) {
+        const auto start = std::chrono::steady_clock::now();
+        fill();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void run(const char* name, const Data& data, std::size_t points, int dims, bool fixed) {
+        auto make = [&]() {
+            AutoHistogram hist(dims);
+            for (int a = 0; fixed && a < dims; ++a) {
+                hist.setRange(a, -4, 4);
+            }
+            return hist;
+        };
+        AutoHistogram single = make();
+        const double perPoint = milliseconds([&]() {
+            for (std::size_t done = 0; done < points; done += block) {
+                const std::size_t first = done % pool;
+                for (std::size_t i = first; i < first + block; ++i) {
+                    if (dims == 2) {
+                        single.fill(data.x[i], data.y[i], data.w[i]);
+                    }
+                    else {
+                        single.fill(data.x[i], data.w[i]);
+                    }
+                }
+            }
+        });
+        AutoHistogram blocks = make();
+        const double perBlock = milliseconds([&]() {
+            for (std::size_t done = 0; done < points; done += block) {
+                const std::size_t first = done % pool;
+                blocks.fill(block, data.x.data() + first, dims == 2 ? data.y.data() + first : nullptr,
+                            data.w.data() + first);
+            }
+        });
+        std::printf("%-9s %8.0f -> %6.0f ms  (x%.1f)%s\n", name, perPoint, perBlock, perPoint / perBlock,
+                    single.entries() == blocks.entries() ? "" : "  entries differ");
+    }
+}
+
+int main(int argc, char** argv) {
+    const std::size_t points = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000000;
+    Data data;
+    std::mt19937_64 random(1);
+    std::normal_distribution<double> normal;
+    for (std::size_t i = 0; i < pool; ++i) {
+        data.x.push_back(normal(random));
+        data.y.push_back(normal(random));
+        data.w.push_back(1 + 0.1 * normal(random));
+    }
+    std::printf("%zu weighted points in blocks of %zu\n", points, block);
+    run("1D auto", data, points, 1, false);
+    run("2D auto", data, points, 2, false);
+    run("1D fixed", data, points, 1, true);
+    run("2D fixed", data, points, 2, true);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "AutoHistogram.h"
+#include "Check.h"
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Built with the flags of the program, so -Ofast must not hide NaN and Inf
+static void nonFiniteValues() {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const double inf = std::numeric_limits<double>::infinity();
+    const std::vector<double> special = {nan, inf, -inf};
+
+    // Point by point, while buffering and after the bins are laid out
+    AutoHistogram points(1, 10);
+    for (int i = 0; i < 100; ++i) {
+        points.fill(i % 10 == 0 ? special[i / 10 % 3] : i);
+    }
+    CHECK(points.nonFinite() == 10);
+    CHECK(points.entries() == 90);
+    CHECK(points.min() == 1 && points.max() == 99);
+
+    // Blocks, NaN and Inf at the start, inside and in the tail of the vector loops
+    for (std::size_t position : {0, 5, 13, 14}) {
+        for (double value : special) {
+            AutoHistogram block(1, 10);
+            std::vector<double> x(15);
+            for (std::size_t i = 0; i < x.size(); ++i) {
+                x[i] = i == position ? value : i;
+            }
+            block.fill(20, std::vector<double>(20, 1.0).data(), nullptr, nullptr); // Past the buffer
+            block.fill(x.size(), x.data(), nullptr, nullptr);
+            CHECK(block.nonFinite() == 1);
+            CHECK(block.entries() == 34);
+            CHECK(std::isfinite(block.min()) && std::isfinite(block.max()));
+        }
+    }
+
+    // 2D, one bad coordinate skips the point
+    AutoHistogram plane(2, 10);
+    for (int i = 0; i < 40; ++i) {
+        plane.fill(i, i == 30 ? nan : i, 1.0);
+    }
+    std::vector<double> x = {1, inf, 3, 4};
+    std::vector<double> y = {1, 2, 3, -inf};
+    plane.fill(x.size(), x.data(), y.data(), nullptr);
+    CHECK(plane.nonFinite() == 3);
+    CHECK(plane.entries() == 41);
+}
+
+// Far values are kept aside exactly up to max_outliers, later ones widen the bins
+static void manyOutliers() {
+    const std::size_t far = AutoHistogram::max_outliers + 500;
+    AutoHistogram hist;
+    for (int i = 0; i < 10000; ++i) {
+        hist.fill(i / 10000.0);
+    }
+    for (std::size_t i = 0; i < far; ++i) {
+        hist.fill(1e6 + i);
+    }
+    CHECK(hist.entries() == static_cast<Long64_t>(10000 + far));
+    CHECK(hist.min() == 0 && hist.max() == 1e6 + far - 1);
+    // Within one fine bin of the widened axis
+    const double width = 2 * (hist.max() - hist.min()) / AutoHistogram::default_bins;
+    CHECK(std::abs(hist.quantile(0.5) - 0.575) <= width);
+    CHECK(std::abs(hist.quantile(0.95) - (1e6 + 924)) <= width);
+    CHECK(std::abs(hist.quantile(1.0) - hist.max()) <= width);
+
+    // Memory stays bounded however many far values follow
+    const std::size_t bytes = hist.memoryUsage();
+    for (std::size_t i = 0; i < 5000; ++i) {
+        hist.fill(-1e7 - static_cast<double>(i));
+    }
+    CHECK(hist.memoryUsage() == bytes);
+    CHECK(hist.entries() == static_cast<Long64_t>(15000 + far));
+
+    AutoHistogram merged;
+    merged.merge(hist);
+    merged.merge(hist);
+    CHECK(merged.entries() == 2 * hist.entries());
+    CHECK(merged.memoryUsage() <= bytes);
+}
+
+int main() {
+    nonFiniteValues();
+    manyOutliers();
+    return check_failures == 0 ? 0 : 1;
+}
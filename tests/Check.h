@@ -0,0 +1,17 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+
+// Failed checks so far, a test returns non-zero from main if there are any
+inline int check_failures = 0;
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            std::printf("%s:%d: failed %s\n", __FILE__, __LINE__, #condition); \
+            check_failures++;                                                  \
+        }                                                                      \
+    } while (0)
+
+#endif // CHECK_H
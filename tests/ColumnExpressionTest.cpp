@@ -0,0 +1,55 @@
+#include "ColumnExpression.h"
+#include "Check.h"
+#include "TTree.h"
+#include "TTreeFormula.h"
+#include <cmath>
+#include <vector>
+
+// Interpreted column expressions against TTreeFormula on the same entries,
+// with zero divisors and values that compare equal
+static void matchesFormula() {
+    std::vector<std::vector<double>> values(2);
+    for (int i = 0; i < 100; ++i) {
+        values[0].push_back(i % 7 - 3);
+        values[1].push_back(i % 5 == 0 ? 0.0 : i % 4 - 1.5);
+    }
+    TTree tree("t", "t");
+    tree.SetDirectory(nullptr);
+    double var1 = 0;
+    double var2 = 0;
+    tree.Branch("var1", &var1, "var1/D");
+    tree.Branch("var2", &var2, "var2/D");
+    for (std::size_t i = 0; i < values[0].size(); ++i) {
+        var1 = values[0][i];
+        var2 = values[1][i];
+        tree.Fill();
+    }
+
+    for (const char* text : {"var1/var2", "var1/(var2-var2)", "1/var2 + var1", "var1/var2 > 0 && var2 != 0",
+                             "sqrt(var1*var1)/var2", "(var1 >= var2) / 2"}) {
+        const auto expression = ColumnExpression::parse(text);
+        CHECK(expression.has_value());
+        if (!expression) {
+            continue;
+        }
+        std::vector<const double*> columns;
+        for (const auto& name : expression->columns()) {
+            columns.push_back(name == "var1" ? values[0].data() : values[1].data());
+        }
+        std::vector<double> out(values[0].size());
+        expression->evaluate(columns, 0, out.size(), out.data());
+
+        TTreeFormula formula("f", text, &tree);
+        for (Long64_t entry = 0; entry < tree.GetEntries(); ++entry) {
+            tree.LoadTree(entry);
+            formula.GetNdata();
+            const double expected = formula.EvalInstance(0);
+            CHECK(out[entry] == expected);
+        }
+    }
+}
+
+int main() {
+    matchesFormula();
+    return check_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+#include "definitions.h"
+#include "Check.h"
+#include <string>
+#include <vector>
+
+static void conjunctions() {
+    using parts = std::vector<std::string>;
+    CHECK(split_conjunction("a>0 && b<1") == (parts{"a>0 ", " b<1"}));
+    CHECK(split_conjunction("a && (b || c) && d[0]") == (parts{"a ", " (b || c) ", " d[0]"}));
+    CHECK(split_conjunction("x & 1 && y") == (parts{"x & 1 ", " y"}));
+    CHECK(split_conjunction("a > 0").empty());
+    CHECK(split_conjunction("(a && b)").empty());
+    // Weaker operators at the top level make the cut one operand
+    CHECK(split_conjunction("a && b || c").empty());
+    CHECK(split_conjunction("a || b && c").empty());
+    CHECK(split_conjunction("a && b ? c : d").empty());
+    CHECK(split_conjunction("x | 1 && y") == (parts{"x | 1 ", " y"}));
+}
+
+static void varexps() {
+    using parts = std::vector<std::string>;
+    CHECK(split_varexp("y:x") == (parts{"y", "x"}));
+    CHECK(split_varexp("a::b") == (parts{"a::b"}));
+    CHECK(split_varexp("c ? a : b") == (parts{"c ? a : b"}));
+    CHECK(split_varexp("f(a:b):x[1]") == (parts{"f(a:b)", "x[1]"}));
+}
+
+int main() {
+    conjunctions();
+    varexps();
+    return check_failures == 0 ? 0 : 1;
+}